@@ -0,0 +1,11 @@
+#!/bin/bash
+
+# Builds the Ginseng microbenchmarks and the Puddle stress test. Run from
+# anywhere; the executables are written next to this script.
+
+DIR="$(cd "$(dirname "$0")" && pwd)"
+
+${CXX:-g++} -std=c++1y -Wall -O2 -DNDEBUG -pthread \
+    -I"$DIR/../src" "$DIR/ginseng.cpp" -o "$DIR/ginseng-bench" "$@" &&
+${CXX:-g++} -std=c++1y -Wall -O2 -DNDEBUG -pthread \
+    -I"$DIR/../src" "$DIR/puddle.cpp" -o "$DIR/puddle-bench" "$@"
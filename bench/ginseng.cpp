@@ -0,0 +1,851 @@
+/* Ginseng microbenchmarks
+ *
+ * A standalone benchmark for ginseng.hpp. It needs nothing but a C++14
+ * compiler; see build.sh in this directory.
+ *
+ * Usage: ginseng-bench [max-entities]
+ *
+ * Every benchmark runs on worlds of 1k, 10k, 100k and 1M entities, up to
+ * max-entities, and reports nanoseconds per operation. Heap usage is
+ * measured by replacing the global operator new.
+ */
+
+#include "ginseng/ginseng.hpp"
+#include "ginseng/scheduler.hpp"
+#include "puddle/puddle.hpp"
+#include "worker.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <map>
+#include <new>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Heap accounting
+
+    namespace {
+
+    atomic<size_t> liveBytes {0};
+
+    // Keeps the block size in front of each allocation.
+    constexpr size_t HEADER = alignof(max_align_t);
+
+    } // namespace
+
+    void* operator new(size_t size)
+    {
+        auto ptr = static_cast<unsigned char*>(malloc(size + HEADER));
+
+        if (!ptr)
+            throw bad_alloc();
+
+        *reinterpret_cast<size_t*>(ptr) = size;
+        liveBytes += size;
+
+        return ptr + HEADER;
+    }
+
+    void operator delete(void* ptr) noexcept
+    {
+        if (!ptr)
+            return;
+
+        auto base = reinterpret_cast<size_t*>(
+            reinterpret_cast<uintptr_t>(ptr) - HEADER);
+        liveBytes -= *base;
+        free(base);
+    }
+
+    void operator delete(void* ptr, size_t) noexcept
+    {
+        operator delete(ptr);
+    }
+
+// Components
+
+    namespace {
+
+    struct Position
+    {
+        double x, y, z;
+    };
+
+    struct Velocity
+    {
+        double x, y;
+    };
+
+    struct Health
+    {
+        int hp;
+    };
+
+    struct Sprite
+    {
+        int id;
+        float time;
+    };
+
+    template <typename T>
+    using PoolAllocator = Puddle::Allocator<T>;
+
+    using DB = Ginseng::Database<PoolAllocator, Ginseng::Components<
+        Position, Velocity, Health, Sprite>>;
+
+    using EntID = DB::EntID;
+    using Ginseng::Not;
+
+// Harness
+
+    using Clock = chrono::steady_clock;
+
+    struct Result
+    {
+        string name;
+        vector<double> values;
+    };
+
+    vector<Result> results;
+    vector<size_t> sizes;
+
+    void record(string const& name, size_t col, double value)
+    {
+        auto iter = find_if(begin(results), end(results),
+            [&](Result const& r){ return r.name == name; });
+
+        if (iter == end(results))
+        {
+            results.push_back(Result{name, vector<double>(sizes.size(), 0)});
+            iter = end(results) - 1;
+        }
+
+        iter->values[col] = value;
+    }
+
+    // Nanoseconds per op for one call of fn that performs ops operations.
+    template <typename F>
+    double measure(size_t ops, F&& fn)
+    {
+        auto start = Clock::now();
+        fn();
+        auto stop = Clock::now();
+
+        return chrono::duration<double, nano>(stop - start).count() / ops;
+    }
+
+    // Repeats fn, which performs ops operations, for at least 50 ms.
+    template <typename F>
+    double measureRepeated(size_t ops, F&& fn)
+    {
+        size_t reps = 0;
+        auto start = Clock::now();
+        auto stop = start;
+
+        do
+        {
+            fn();
+            ++reps;
+            stop = Clock::now();
+        }
+        while (stop - start < chrono::milliseconds(50));
+
+        return chrono::duration<double, nano>(stop - start).count()
+            / (double(ops) * reps);
+    }
+
+    // Keeps results of query loops observable.
+    volatile double sink;
+
+    // Stops the run if a benchmark computed the wrong result.
+    void expect(bool ok, char const* what)
+    {
+        if (ok)
+            return;
+
+        fprintf(stderr, "Failed: %s\n", what);
+        exit(1);
+    }
+
+    /* A world where every Entity has a Position, 3/4 have a Velocity, 1/2
+     * have Health, and 1/4 have a Sprite, in shuffled combinations.
+     */
+    vector<EntID> populate(DB& db, size_t count, mt19937& rng)
+    {
+        vector<EntID> rv;
+        rv.reserve(count);
+
+        for (size_t i=0; i<count; ++i)
+        {
+            auto eid = db.makeEntity();
+            auto bits = rng();
+
+            db.makeComponent(eid, Position{double(i), 0, 0});
+
+            if (bits & 3)
+                db.makeComponent(eid, Velocity{1, 1});
+            if (bits & 4)
+                db.makeComponent(eid, Health{100});
+            if ((bits & 24) == 0)
+                db.makeComponent(eid, Sprite{int(i), 0});
+
+            rv.push_back(eid);
+        }
+
+        return rv;
+    }
+
+// Benchmarks
+
+    void benchCreation(size_t col, size_t n)
+    {
+        {
+            DB db;
+            record("makeEntity", col, measure(n, [&]
+            {
+                for (size_t i=0; i<n; ++i)
+                    db.makeEntity();
+            }));
+        }
+
+        {
+            DB db;
+            vector<EntID> eids;
+            eids.reserve(n);
+
+            for (size_t i=0; i<n; ++i)
+                eids.push_back(db.makeEntity());
+
+            record("makeComponent", col, measure(2*n, [&]
+            {
+                for (auto eid : eids)
+                {
+                    db.makeComponent(eid, Position{0, 0, 0});
+                    db.makeComponent(eid, Velocity{0, 0});
+                }
+            }));
+        }
+
+        {
+            DB db;
+            record("createMany<P,V>", col, measure(n, [&]
+            {
+                db.createMany<Position, Velocity>(n,
+                    [](EntID, Position&, Velocity&){});
+            }));
+        }
+
+        {
+            DB db;
+            record("createMany<P,V,H,S>", col, measure(n, [&]
+            {
+                db.createMany<Position, Velocity, Health, Sprite>(n,
+                    [](EntID, Position&, Velocity&, Health& h, Sprite& s)
+                    {
+                        h.hp = 3;
+                        s.id = 7;
+                    });
+            }));
+        }
+
+        {
+            DB db;
+            auto prefab = db.makePrefab(Position{0, 0, 0}, Velocity{0, 0},
+                                        Health{3}, Sprite{7, 0});
+
+            record("instantiate<P> (P,V,H,S)", col, measure(n, [&]
+            {
+                db.instantiate<Position>(prefab, n,
+                    [](EntID, Position& p){ p.x = 1; });
+            }));
+        }
+
+        {
+            DB db;
+            auto eid = db.makeEntity();
+            db.makeComponent(eid, Position{0, 0, 0});
+            db.makeComponent(eid, Velocity{0, 0});
+            db.makeComponent(eid, Health{3});
+            db.makeComponent(eid, Sprite{7, 0});
+
+            record("cloneEntity (P,V,H,S)", col, measure(n, [&]
+            {
+                for (size_t i=0; i<n; ++i)
+                    db.cloneEntity(eid);
+            }));
+        }
+
+        {
+            auto before = liveBytes.load();
+
+            {
+                DB db;
+                db.createMany<Position, Velocity>(n,
+                    [](EntID, Position&, Velocity&){});
+
+                record("bytes/entity (P,V)", col,
+                    double(liveBytes - before) / n);
+            }
+        }
+    }
+
+    void benchChurn(size_t col, size_t n, mt19937& rng)
+    {
+        DB db;
+        auto eids = populate(db, n, rng);
+        uniform_int_distribution<size_t> pick (0, n - 1);
+
+        record("eraseEntity churn", col, measure(n, [&]
+        {
+            for (size_t i=0; i<n; ++i)
+            {
+                auto& eid = eids[pick(rng)];
+                db.eraseEntity(eid);
+                eid = db.makeEntity();
+                db.makeComponent(eid, Position{0, 0, 0});
+                db.makeComponent(eid, Velocity{0, 0});
+            }
+        }));
+    }
+
+    /* A mixed world after 90% of its Entities are erased at random. Heap
+     * use is reported per original Entity, before and after compact().
+     */
+    void benchCompact(size_t col, size_t n, mt19937& rng)
+    {
+        auto before = liveBytes.load();
+
+        DB db;
+        auto eids = populate(db, n, rng);
+        shuffle(begin(eids), end(eids), rng);
+
+        for (size_t i=0; i<n-n/10; ++i)
+            db.eraseEntity(eids[i]);
+
+        record("bytes/entity, 90% erased", col,
+            double(liveBytes - before) / n);
+
+        record("compact()", col, measure(n, [&]
+        {
+            db.compact();
+        }));
+
+        record("bytes/entity, compacted", col,
+            double(liveBytes - before) / n);
+    }
+
+    void benchAccess(size_t col, size_t n, mt19937& rng)
+    {
+        DB db;
+        auto before = liveBytes.load();
+        auto eids = populate(db, n, rng);
+
+        record("bytes/entity (mixed)", col,
+            double(liveBytes - before - eids.capacity() * sizeof(EntID)) / n);
+
+        shuffle(begin(eids), end(eids), rng);
+
+        record("get<Position>() random", col, measureRepeated(n, [&]
+        {
+            double sum = 0;
+            for (auto eid : eids)
+                sum += eid.get<Position>().data().x;
+            sink = sum;
+        }));
+
+        auto visited = [&](size_t count)
+        {
+            return max(count, size_t(1));
+        };
+
+        auto n1 = visited(db.poolSize<Position>());
+        record("for_each<P>", col, measureRepeated(n1, [&]
+        {
+            double sum = 0;
+            db.for_each<Position const>([&](EntID, Position const& p)
+            {
+                sum += p.x;
+            });
+            sink = sum;
+        }));
+
+        auto n2 = visited(db.query<Position, Velocity>().size());
+        record("for_each<P,V>", col, measureRepeated(n2, [&]
+        {
+            db.for_each<Position, Velocity const>(
+                [](EntID, Position& p, Velocity const& v)
+                {
+                    p.x += v.x;
+                    p.y += v.y;
+                });
+        }));
+
+        auto n3 = visited(db.query<Position, Velocity, Health>().size());
+        record("for_each<P,V,H>", col, measureRepeated(n3, [&]
+        {
+            db.for_each<Position const, Velocity, Health const>(
+                [](EntID, Position const& p, Velocity& v, Health const& h)
+                {
+                    v.x = p.x * h.hp;
+                });
+        }));
+
+        auto n4 = visited(
+            db.query<Position, Velocity, Health, Sprite>().size());
+        record("for_each<P,V,H,S>", col, measureRepeated(n4, [&]
+        {
+            db.for_each<Position const, Velocity const, Health const,
+                        Sprite>(
+                [](EntID, Position const& p, Velocity const& v,
+                   Health const& h, Sprite& s)
+                {
+                    s.time += float(p.x + v.x + h.hp);
+                });
+        }));
+
+        auto nn = visited(db.query<Position, Not<Health>>().size());
+        record("for_each<P,Not<H>>", col, measureRepeated(nn, [&]
+        {
+            double sum = 0;
+            db.for_each<Position const, Not<Health>>(
+                [&](EntID, Position const& p)
+                {
+                    sum += p.x;
+                });
+            sink = sum;
+        }));
+
+        record("view<P,V>", col, measureRepeated(n2, [&]
+        {
+            double sum = 0;
+            for (auto&& ele : db.view<Position const, Velocity const>())
+                sum += get<1>(ele).data().x + get<2>(ele).data().x;
+            sink = sum;
+        }));
+
+        record("query<P,V>", col, measureRepeated(n2, [&]
+        {
+            sink = double(db.query<Position const, Velocity const>().size());
+        }));
+
+        // Per row visited. Positions are created in order, so few rows move.
+        record("reorder<P> x512", col, measureRepeated(512, [&]
+        {
+            db.reorder<Position>([](Position const& p)
+            {
+                return Ginseng::mortonCode(uint32_t(p.x), uint32_t(p.y));
+            }, 512);
+        }));
+    }
+
+    /* One frame of a game-like workload: movement, 1% of Entities gaining
+     * or losing Health through a CommandBuffer, and 0.5% replaced.
+     * Reported per Entity per frame.
+     */
+    void benchMixed(size_t col, size_t n, mt19937& rng)
+    {
+        DB db;
+        auto eids = populate(db, n, rng);
+        DB::CommandBuffer commands;
+        uniform_int_distribution<size_t> pick (0, n - 1);
+        auto changes = max(n / 100, size_t(1));
+        auto replaced = max(n / 200, size_t(1));
+        vector<size_t> doomed;
+
+        record("mixed frame", col, measureRepeated(n, [&]
+        {
+            db.for_each<Position, Velocity const>(
+                [](EntID, Position& p, Velocity const& v)
+                {
+                    p.x += v.x;
+                    p.y += v.y;
+                });
+
+            for (size_t i=0; i<changes; ++i)
+            {
+                auto eid = eids[pick(rng)];
+
+                if (eid.get<Health>())
+                    commands.remove<Health>(eid);
+                else
+                    commands.add(eid, Health{100});
+            }
+
+            doomed.clear();
+
+            for (size_t i=0; i<replaced; ++i)
+            {
+                doomed.push_back(pick(rng));
+                commands.destroy(eids[doomed.back()]);
+            }
+
+            db.flush(commands);
+
+            for (auto i : doomed)
+            {
+                if (!db.isValid(eids[i]))
+                {
+                    eids[i] = db.makeEntity();
+                    db.makeComponent(eids[i], Position{0, 0, 0});
+                    db.makeComponent(eids[i], Velocity{1, 1});
+                }
+            }
+        }));
+    }
+
+    struct PositionPoint
+    {
+        pair<double,double> operator()(Position const& p) const
+        {
+            return {p.x, p.y};
+        }
+    };
+
+    struct GridIndex : DB::GridIndex<Position, PositionPoint>
+    {
+        GridIndex()
+            : DB::GridIndex<Position, PositionPoint>(128)
+        {}
+    };
+
+    /* Entities scattered over a square, 32 units apart on average, culled
+     * to a view of 1% of the area. Culling is reported per query; building
+     * the index and keeping it in sync with 1% of Entities moving are
+     * reported per Entity.
+     */
+    void benchIndexes(size_t col, size_t n, mt19937& rng)
+    {
+        DB db;
+        auto side = sqrt(double(n)) * 32;
+        uniform_real_distribution<double> coord (0, side);
+        vector<EntID> eids;
+        eids.reserve(n);
+
+        for (size_t i=0; i<n; ++i)
+        {
+            eids.push_back(db.makeEntity());
+            db.makeComponent(eids.back(), Position{coord(rng), coord(rng), 0});
+        }
+
+        auto left = side * 0.45;
+        auto right = side * 0.55;
+
+        record("cull 1% by for_each<P>", col, measureRepeated(1, [&]
+        {
+            size_t hits = 0;
+            db.for_each<Position const>([&](EntID, Position const& p)
+            {
+                hits += (p.x >= left && p.x <= right
+                    && p.y >= left && p.y <= right);
+            });
+            sink = hits;
+        }));
+
+        record("index<Grid> build", col, measure(n, [&]
+        {
+            db.index<GridIndex>();
+        }));
+
+        record("cull 1% by queryRect", col, measureRepeated(1, [&]
+        {
+            sink = db.index<GridIndex>()
+                .queryRect(left, left, right, right).size();
+        }));
+
+        uniform_int_distribution<size_t> pick (0, n - 1);
+        auto moves = max(n / 100, size_t(1));
+
+        record("index sync, 1% moved", col, measureRepeated(n, [&]
+        {
+            for (size_t i=0; i<moves; ++i)
+            {
+                auto eid = eids[pick(rng)];
+                eid.get<Position>().data().x = coord(rng);
+                db.markChanged<Position>(eid);
+            }
+
+            db.index<GridIndex>();
+        }));
+    }
+
+    /* A rollback history: each tick writes the Positions of 1% of Entities
+     * and takes a snapshot, keeping the last 120. Snapshot and restore are
+     * reported per Entity; memory is the growth of the history per tick.
+     */
+    void benchSnapshots(size_t col, size_t n, mt19937& rng)
+    {
+        DB db;
+        auto eids = populate(db, n, rng);
+        uniform_int_distribution<size_t> pick (0, n - 1);
+        auto writes = max(n / 100, size_t(1));
+        deque<DB::Snapshot> history;
+
+        auto tick = [&]
+        {
+            for (size_t i=0; i<writes; ++i)
+                eids[pick(rng)].get<Position>().data().x += 1;
+        };
+
+        for (size_t t=0; t<120; ++t)
+        {
+            tick();
+            history.push_back(db.snapshot());
+        }
+
+        record("snapshot() x120 ring", col, measureRepeated(n, [&]
+        {
+            tick();
+            history.pop_front();
+            history.push_back(db.snapshot());
+        }));
+
+        size_t back = 0;
+
+        record("restore() 1 tick back", col, measureRepeated(n, [&]
+        {
+            db.restore(history[history.size() - 1 - (back++ % 2)]);
+        }));
+
+        auto with = liveBytes.load();
+        history.clear();
+
+        record("bytes/entity/snapshot", col,
+            double(with - liveBytes.load()) / 120 / n);
+    }
+
+    /* Movement on one thread while another reads every Position, as a
+     * renderer would. Serial frames run one after the other; overlapped
+     * frames publish to a FrontBuffer and then run both at once. Reported
+     * per Entity per frame.
+     */
+    void benchFrontBuffer(size_t col, size_t n, mt19937& rng)
+    {
+        DB db;
+        populate(db, n, rng);
+        DB::FrontBuffer<Position> front;
+
+        auto simulate = [&]
+        {
+            db.for_each<Position, Velocity const>(
+                [](EntID, Position& p, Velocity const& v)
+                {
+                    p.x += v.x;
+                    p.y += v.y;
+                });
+        };
+
+        record("publish()", col, measureRepeated(n, [&]
+        {
+            db.publish(front);
+        }));
+
+        record("frame, serial", col, measureRepeated(n, [&]
+        {
+            simulate();
+
+            double sum = 0;
+            db.for_each<Position const>([&](EntID, Position const& p)
+            {
+                sum += p.x + p.y;
+            });
+            sink = size_t(sum);
+        }));
+
+        Worker sim;
+
+        record("frame, overlapped", col, measureRepeated(n, [&]
+        {
+            db.publish(front);
+            sim.run(simulate);
+
+            double sum = 0;
+            front.for_each([&](EntID, Position const& p)
+            {
+                sum += p.x + p.y;
+            });
+            sink = size_t(sum);
+
+            sim.wait();
+        }));
+    }
+
+    /* Two systems that share no components, which the Scheduler runs at
+     * once. Each frame is on a new Database, so both make their query
+     * caches while the other runs. Reported per Entity per frame.
+     */
+    void benchScheduler(size_t col, size_t n)
+    {
+        Ginseng::ThreadPool pool (1);
+        Ginseng::Scheduler systems;
+        DB* db = nullptr;
+        double health = 0;
+        double sprites = 0;
+
+        systems.addSystem<Health const>([&]
+        {
+            health = 0;
+            db->for_each<Health const>([&](EntID, Health const& h)
+            {
+                health += h.hp;
+            });
+        });
+
+        systems.addSystem<Sprite>([&]
+        {
+            sprites = 0;
+            db->for_each<Sprite>([&](EntID, Sprite& s)
+            {
+                s.time += 1;
+                sprites += 1;
+            });
+        });
+
+        record("Scheduler, new queries", col, measureRepeated(n, [&]
+        {
+            DB fresh;
+            fresh.createMany<Health>(n / 2, [](EntID, Health& h)
+            {
+                h.hp = 2;
+            });
+            fresh.createMany<Sprite>(n / 4, [](EntID, Sprite&){});
+
+            db = &fresh;
+            systems.run(pool);
+            db = nullptr;
+
+            expect(health == double(n / 2) * 2 && sprites == double(n / 4),
+                   "Scheduler, new queries");
+        }));
+    }
+
+    /* Saving a world, and loading it into an empty Database. Components
+     * are trivially copyable, so their pages are mapped in place; the first
+     * pass over them pays for reading the file.
+     */
+    void benchSaveLoad(size_t col, size_t n, mt19937& rng)
+    {
+        char const* path = "ginseng-bench.sav";
+
+        // Entity i is placed at x = i.
+        auto sumX = [](DB& db)
+        {
+            double sum = 0;
+            db.for_each<Position const>([&](EntID, Position const& p)
+            {
+                sum += p.x;
+            });
+            return sum;
+        };
+
+        auto expected = double(n) * (n - 1) / 2;
+
+        {
+            DB db;
+            populate(db, n, rng);
+
+            record("save()", col, measure(n, [&]
+            {
+                db.save(path);
+            }));
+        }
+
+        {
+            DB db;
+            record("load()", col, measure(n, [&]
+            {
+                db.load(path);
+            }));
+        }
+
+        {
+            DB db;
+            record("load() + for_each<P>", col, measure(n, [&]
+            {
+                db.load(path);
+                sink = sumX(db);
+            }));
+            expect(sink == expected, "load() + for_each<P>");
+        }
+
+        // The loaded pages are still backed by the file being replaced.
+        {
+            DB db;
+            db.load(path);
+
+            record("save() over loaded file", col, measure(n, [&]
+            {
+                db.save(path);
+            }));
+            expect(sumX(db) == expected, "save() over loaded file");
+
+            DB copy;
+            copy.load(path);
+            expect(sumX(copy) == expected, "load() of resaved file");
+        }
+
+        // Storage reserved before loading holds no rows.
+        {
+            DB db;
+            db.reserve<Position>(n);
+            db.load(path);
+            expect(sumX(db) == expected, "load() after reserve<P>()");
+        }
+
+        remove(path);
+    }
+
+    } // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t maxEntities = 1000000;
+
+    if (argc > 1)
+        maxEntities = strtoul(argv[1], nullptr, 10);
+
+    for (size_t n=1000; n<=maxEntities; n*=10)
+        sizes.push_back(n);
+
+    for (size_t col=0; col<sizes.size(); ++col)
+    {
+        auto n = sizes[col];
+        mt19937 rng (12345);
+
+        fprintf(stderr, "Running %zu entities...\n", n);
+
+        benchCreation(col, n);
+        benchChurn(col, n, rng);
+        benchCompact(col, n, rng);
+        benchAccess(col, n, rng);
+        benchMixed(col, n, rng);
+        benchIndexes(col, n, rng);
+        benchSnapshots(col, n, rng);
+        benchFrontBuffer(col, n, rng);
+        benchScheduler(col, n);
+        benchSaveLoad(col, n, rng);
+    }
+
+    printf("%-24s", "ns/op");
+    for (auto n : sizes)
+        printf("%12zu", n);
+    printf("\n");
+
+    for (auto const& r : results)
+    {
+        printf("%-24s", r.name.c_str());
+        for (auto v : r.values)
+            printf("%12.2f", v);
+        printf("\n");
+    }
+}
@@ -0,0 +1,316 @@
+/* Puddle stress test and throughput benchmark
+ *
+ * A standalone program for puddle.hpp; see build.sh in this directory.
+ *
+ * Usage: puddle-bench [seconds-per-run]
+ *
+ * Every workload runs on 1, 4 and 16 threads at once, and reports millions
+ * of allocate/deallocate pairs per second, summed over the threads. Each
+ * object is stamped by its owner and checked before it is freed, so a pool
+ * that hands one element to two threads, or corrupts one, fails loudly.
+ */
+
+#include "puddle/puddle.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Objects
+
+    namespace {
+
+    struct Object
+    {
+        size_t owner;
+        size_t serial;
+        size_t check;
+    };
+
+    using Pool = Puddle::Allocator<Object>;
+
+    Object* make(Pool& pool, size_t owner, size_t serial)
+    {
+        auto obj = pool.allocate(1);
+        obj->owner = owner;
+        obj->serial = serial;
+        obj->check = ~(owner ^ serial);
+        return obj;
+    }
+
+    void verify(Object const* obj)
+    {
+        if (obj->check != ~(obj->owner ^ obj->serial))
+        {
+            fprintf(stderr, "Corrupt object %p!\n", (void const*)obj);
+            abort();
+        }
+    }
+
+    } // namespace
+
+// Harness
+
+    namespace {
+
+    using Clock = chrono::steady_clock;
+
+    struct Result
+    {
+        string name;
+        vector<double> values;
+    };
+
+    vector<Result> results;
+    vector<size_t> threadCounts = {1, 4, 16};
+    double seconds = 0.25;
+
+    void record(string const& name, size_t col, double value)
+    {
+        auto iter = find_if(begin(results), end(results),
+            [&](Result const& r){ return r.name == name; });
+
+        if (iter == end(results))
+        {
+            results.push_back(Result{name,
+                                     vector<double>(threadCounts.size(), 0)});
+            iter = end(results) - 1;
+        }
+
+        iter->values[col] = value;
+    }
+
+    /* Lets threads wait for each other between rounds.
+     */
+    class Barrier
+    {
+        mutex m;
+        condition_variable cv;
+        size_t count;
+        size_t waiting = 0;
+        size_t generation = 0;
+
+        public:
+
+            explicit Barrier(size_t n)
+                : count(n)
+            {}
+
+            void wait()
+            {
+                unique_lock<mutex> lock (m);
+                auto gen = generation;
+
+                if (++waiting == count)
+                {
+                    waiting = 0;
+                    ++generation;
+                    cv.notify_all();
+                    return;
+                }
+
+                cv.wait(lock, [&]{ return gen != generation; });
+            }
+    };
+
+    /* Runs fn(thread, stop) on each of threads threads, where stop() tells
+     * it when time is up, and returns millions of pairs per second given
+     * the total fn returned.
+     */
+    template <typename F>
+    double run(size_t threads, F&& fn)
+    {
+        atomic<bool> done {false};
+        atomic<size_t> pairs {0};
+        vector<thread> workers;
+
+        auto start = Clock::now();
+
+        for (size_t t=0; t<threads; ++t)
+        {
+            workers.emplace_back([&, t]
+            {
+                pairs += fn(t, [&]{ return done.load(); });
+            });
+        }
+
+        this_thread::sleep_for(chrono::duration<double>(seconds));
+        done = true;
+
+        for (auto& worker : workers)
+            worker.join();
+
+        auto stop = Clock::now();
+
+        return pairs / chrono::duration<double, micro>(stop - start).count();
+    }
+
+    } // namespace
+
+// Workloads
+
+    namespace {
+
+    /* Allocates a burst of 256 objects, then frees them all, as a system
+     * building temporary lists would.
+     */
+    void benchBursts(size_t col, size_t threads)
+    {
+        record("bursts of 256", col, run(threads, [](size_t t, auto stop)
+        {
+            Pool pool;
+            vector<Object*> objs;
+            size_t serial = 0;
+
+            while (!stop())
+            {
+                for (size_t i=0; i<256; ++i)
+                    objs.push_back(make(pool, t, serial++));
+
+                for (auto obj : objs)
+                {
+                    verify(obj);
+                    pool.deallocate(obj, 1);
+                }
+
+                objs.clear();
+            }
+
+            return serial;
+        }));
+    }
+
+    /* Keeps 4096 live objects and replaces one at random each step, so
+     * frees come in a shuffled order.
+     */
+    void benchChurn(size_t col, size_t threads)
+    {
+        record("random churn", col, run(threads, [](size_t t, auto stop)
+        {
+            Pool pool;
+            mt19937 rng (t);
+            vector<Object*> objs;
+            size_t serial = 0;
+
+            for (size_t i=0; i<4096; ++i)
+                objs.push_back(make(pool, t, serial++));
+
+            size_t pairs = 0;
+
+            while (!stop())
+            {
+                for (size_t i=0; i<1024; ++i)
+                {
+                    auto& slot = objs[rng() % objs.size()];
+                    verify(slot);
+                    pool.deallocate(slot, 1);
+                    slot = make(pool, t, serial++);
+                }
+
+                pairs += 1024;
+            }
+
+            for (auto obj : objs)
+                pool.deallocate(obj, 1);
+
+            return pairs;
+        }));
+    }
+
+    /* Each round, every thread allocates 1024 objects and frees the ones
+     * its neighbour allocated the round before, so elements keep moving
+     * between threads through the global depot.
+     */
+    void benchHandoff(size_t col, size_t threads)
+    {
+        vector<vector<Object*>> lists (threads);
+        Barrier barrier (threads);
+        atomic<bool> finished {false};
+
+        record("cross-thread frees", col, run(threads, [&](size_t t, auto stop)
+        {
+            Pool pool;
+            size_t serial = 0;
+            size_t pairs = 0;
+
+            for (;;)
+            {
+                barrier.wait();
+
+                if (t == 0 && stop())
+                    finished = true;
+
+                barrier.wait();
+
+                if (finished)
+                    break;
+
+                for (auto obj : lists[(t + 1) % threads])
+                {
+                    verify(obj);
+                    pool.deallocate(obj, 1);
+                }
+
+                pairs += lists[(t + 1) % threads].size();
+
+                barrier.wait();
+
+                auto& mine = lists[t];
+                mine.clear();
+
+                for (size_t i=0; i<1024; ++i)
+                    mine.push_back(make(pool, t, serial++));
+            }
+
+            for (auto obj : lists[t])
+                pool.deallocate(obj, 1);
+
+            return pairs;
+        }));
+    }
+
+    } // namespace
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1)
+        seconds = strtod(argv[1], nullptr);
+
+    for (size_t col=0; col<threadCounts.size(); ++col)
+    {
+        auto threads = threadCounts[col];
+
+        fprintf(stderr, "Running %zu threads...\n", threads);
+
+        benchBursts(col, threads);
+        benchChurn(col, threads);
+        benchHandoff(col, threads);
+    }
+
+    // Every object has been freed, so the pool should empty completely.
+    Pool pool;
+    fprintf(stderr, "trim() released %zu bytes.\n", pool.trim());
+
+    printf("%-24s", "Mpairs/s");
+    for (auto n : threadCounts)
+        printf("%9zu thr", n);
+    printf("\n");
+
+    for (auto const& r : results)
+    {
+        printf("%-24s", r.name.c_str());
+        for (auto v : r.values)
+            printf("%13.2f", v);
+        printf("\n");
+    }
+}
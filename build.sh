@@ -43,8 +43,8 @@ fi
 ### Shared Flags - Applies to all targets and platforms ###
 ###########################################################
 
-S_CXXFLAGS="-std=c++1y -Wall -DGLM_FORCE_RADIANS -DGLEW_STATIC -DGLFW_INCLUDE_GLCOREARB"
-S_LDFLAGS=""
+S_CXXFLAGS="-std=c++1y -Wall -pthread -DGLM_FORCE_RADIANS -DGLEW_STATIC -DGLFW_INCLUDE_GLCOREARB"
+S_LDFLAGS="-pthread"
 S_LDLIBS="-lyaml-cpp -lpng -lz"
 
 ####################################################
@@ -30,20 +30,18 @@ void GoombaAI::operator()(Game& game, EntID ent, AI const& ai)
         vel.vy += 15;
     }
 
-    #if 0
     if (!ai.senses.hitsTop.empty())
     {
         for (auto&& ent2 : ai.senses.hitsTop)
         {
-            auto ai2 = ent2.get<AI>();
+            auto ai2 = ent2.get<AI const>();
             if (ai2 && (ai2.data().brainEq<GoombaAI>() || ai2.data().brainEq<PlayerAI>()))
             {
-                game.entities.makeComponent(ent, KillMe{});
+                game.commands.add(ent, KillMe{});
                 break;
             }
         }
     }
-    #endif
 }
 
 } // namespace Component
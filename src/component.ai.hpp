@@ -38,6 +38,12 @@ public:
     {
         return (brain.target_type() == typeid(T));
     }
+
+    template <typename T>
+    T const* getBrain() const
+    {
+        return brain.target<T>();
+    }
 };
 
 } // namespace Component
@@ -10,7 +10,9 @@ struct Sprite
     std::string name;
     std::string anim;
     unsigned anim_frame = -1;
-    int ticker = 0;
+
+    // Game::ticks at which anim_frame advances.
+    int next_frame = 0;
 
     struct
     {
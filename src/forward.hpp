@@ -3,4 +3,17 @@
 
 class Game;
 
+namespace Component {
+
+class AI;
+struct CamLook;
+struct KillMe;
+struct PlayerAI;
+struct Position;
+struct Solid;
+struct Sprite;
+struct Velocity;
+
+} // namespace Component
+
 #endif // FORWARD_HPP
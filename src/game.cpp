@@ -7,12 +7,16 @@
 #include "rect.hpp"
 #include "level.hpp"
 #include "components.hpp"
+#include "spatialindex.hpp"
 
+#include <cmath>
+#include <cstdint>
 #include <tuple>
 #include <random>
 #include <string>
 #include <limits>
 #include <functional>
+#include <stdexcept>
 #include <vector>
 
 #include <yaml-cpp/yaml.h>
@@ -33,7 +37,7 @@ using namespace Component;
 
     // Configuration
 
-        addCallback([&]{ tick(); draw(); }, 60.0);
+        addCallback([&]{ step(); }, 60.0);
         setWindowTitle("Escape", true);
 
         min_view.width = (params.width);
@@ -46,139 +50,297 @@ using namespace Component;
         loadTextures();
         loadSprites();
 
+    // Systems
+
+        // Each system lists the components it reads (const) and writes.
+        // The command buffer is listed as a resource, since AIs queue into it.
+
+        systems.addSystem<AI>([&]
+        {
+            entities.for_each<AI>([](EntID, AI& ai)
+            {
+                ai.clearSenses();
+            });
+        });
+
+        systems.addSystem<Position, Velocity, AI, Solid const>([&]
+        {
+            runPhysics();
+        });
+
+        systems.addSystem<AI, Position const, Velocity,
+                          ECDatabase::CommandBuffer>([&]
+        {
+            procAIs();
+        });
+
+        systems.addExclusive([&]
+        {
+            entities.flush(commands);
+        });
+
+        systems.addExclusive([&]
+        {
+            slaughter();
+        });
+
+        systems.addSystem<Sprite>([&]
+        {
+            animateSprites();
+        });
+
+        // Storage is kept in Z-order of tile cells, a little each frame, so
+        // physics and culling sweep neighbours that are close in memory.
+        systems.addExclusive([&]
+        {
+            auto cell = [&](double v)
+            {
+                return uint32_t(int32_t(floor(v / tileWidth))) ^ 0x80000000u;
+            };
+
+            entities.reorder<Position>([&](Position const& pos)
+            {
+                return Ginseng::mortonCode(cell(pos.x), cell(pos.y));
+            }, 512);
+        });
+
     // Entities
 
+        registerSerializers();
+
+        // A saved world is mapped in as is; otherwise one is built. A save
+        // that cannot be loaded, for any reason, leaves entities empty.
+        try
+        {
+            entities.load(saveFile);
+        }
+        catch (exception const&)
+        {
+            buildWorld();
+        }
+    }
+
+// World Functions
+
+    void Game::buildWorld()
+    {
+        auto _ = profiler->scope("Game::buildWorld()");
+
+    // Entities
+
+        // Components are built as values before being attached, since adding
+        // a component moves the Entity's other components to a new archetype.
+
         // Player
 
             {
                 auto ent = entities.makeEntity();
 
-                auto& sprite = entities.makeComponent(ent, Sprite{}).data();
+                Sprite sprite;
                 sprite.name = "player";
                 sprite.anim = "idle";
+                entities.makeComponent(ent, move(sprite));
 
-                auto& pos = entities.makeComponent(ent, Position{}).data();
+                Position pos;
                 pos.x = 64;
                 pos.y = 64;
+                entities.makeComponent(ent, pos);
 
-                auto& vel = entities.makeComponent(ent, Velocity{}).data();
+                entities.makeComponent(ent, Velocity{});
 
-                auto& solid = entities.makeComponent(ent, Solid{}).data();
+                Solid solid;
                 solid.rect.left = -14;
                 solid.rect.right = solid.rect.left + 28;
                 solid.rect.bottom = -16;
                 solid.rect.top = solid.rect.bottom + 28;
+                entities.makeComponent(ent, solid);
 
-                PlayerAI ai;
-                ai.setInput(PlayerAI::LEFT,  iface->key(Interface::ivkArrow('L')));
-                ai.setInput(PlayerAI::RIGHT, iface->key(Interface::ivkArrow('R')));
-                ai.setInput(PlayerAI::DOWN,  iface->key(Interface::ivkArrow('D')));
-                ai.setInput(PlayerAI::UP,    iface->key(Interface::ivkArrow('U')));
-                auto& aic = entities.makeComponent(ent, AI{move(ai)}).data();
+                entities.makeComponent(ent, AI{makePlayerAI()});
 
-                auto& cam = entities.makeComponent(ent, CamLook{}).data();
+                CamLook cam;
                 cam.aabb = solid.rect;
+                entities.makeComponent(ent, cam);
             }
 
-        // Fire Pots
+        // Fire Pots, Goombas and Balls are each defined once as a prefab,
+        // then stamped out in bulk; only their positions differ.
 
-            for (int i=0; i<500; ++i)
+            auto makeSprite = [](string name, string anim)
             {
-                auto ent = entities.makeEntity();
+                Sprite sprite;
+                sprite.name = move(name);
+                sprite.anim = move(anim);
+                return sprite;
+            };
 
-                auto& sprite = entities.makeComponent(ent, Sprite{}).data();
-                sprite.name = "tile";
-                sprite.anim = "firepot";
+            Solid body;
+            body.rect.left = -14;
+            body.rect.right = body.rect.left + 28;
+            body.rect.bottom = -16;
+            body.rect.top = body.rect.bottom + 28;
 
-                auto& pos = entities.makeComponent(ent, Position{}).data();
+            auto scatter = [&](EntID, Position& pos)
+            {
                 pos.x = (rng()%149+1)*16;
                 pos.y = (rng()%149+1)*16;
-                pos.z = -0.5;
-            }
+            };
 
-        // Goombas
+        // Fire Pots
 
-            for (int i=0; i<50; ++i)
             {
-                auto ent = entities.makeEntity();
+                Position pos;
+                pos.z = -0.5;
 
-                auto& sprite = entities.makeComponent(ent, Sprite{}).data();
-                sprite.name = "goomba";
-                sprite.anim = "idle";
+                auto firepot = entities.makePrefab(
+                    makeSprite("tile", "firepot"), pos);
 
-                auto& pos = entities.makeComponent(ent, Position{}).data();
-                pos.x = (rng()%149+1)*16;
-                pos.y = (rng()%149+1)*16;
+                entities.instantiate<Position>(firepot, 500, scatter);
+            }
 
-                auto& vel = entities.makeComponent(ent, Velocity{}).data();
+        // Goombas
 
-                auto& solid = entities.makeComponent(ent, Solid{}).data();
-                solid.rect.left = -14;
-                solid.rect.right = solid.rect.left + 28;
-                solid.rect.bottom = -16;
-                solid.rect.top = solid.rect.bottom + 28;
+            {
+                auto goomba = entities.makePrefab(
+                    makeSprite("goomba", "idle"), Position{}, Velocity{}, body,
+                    AI{GoombaAI{}});
 
-                auto& ai = entities.makeComponent(ent, AI{GoombaAI{}}).data();
+                entities.instantiate<Position>(goomba, 50, scatter);
             }
 
         // Balls
 
-            for (int i=0; i<50; ++i)
             {
-                auto ent = entities.makeEntity();
-
-                auto& sprite = entities.makeComponent(ent, Sprite{}).data();
-                sprite.name = "ball";
-                sprite.anim = "ball";
-
-                auto& pos = entities.makeComponent(ent, Position{}).data();
-                pos.x = (rng()%149+1)*16;
-                pos.y = (rng()%149+1)*16;
-
-                auto& vel = entities.makeComponent(ent, Velocity{}).data();
+                auto ball = entities.makePrefab(
+                    makeSprite("ball", "ball"), Position{}, Velocity{}, body);
 
-                auto& solid = entities.makeComponent(ent, Solid{}).data();
-                solid.rect.left = -14;
-                solid.rect.right = solid.rect.left + 28;
-                solid.rect.bottom = -16;
-                solid.rect.top = solid.rect.bottom + 28;
+                entities.instantiate<Position>(ball, 50, scatter);
             }
 
     // Load Level
 
         Level lvl;
 
-        for (int i=0; i<lvl.height; ++i)
         {
-            for (int j=0; j<lvl.width; ++j)
+            // Tiles are split by kind first so each kind is built in one batch.
+            vector<pair<int,int>> bricks;
+            vector<pair<int,int>> background;
+
+            for (int i=0; i<lvl.height; ++i)
             {
-                auto tile = entities.makeEntity();
+                for (int j=0; j<lvl.width; ++j)
+                {
+                    if (lvl.at(0,i,j) == 1)
+                        bricks.emplace_back(i, j);
+                    else
+                        background.emplace_back(i, j);
+                }
+            }
 
-                auto& pos = entities.makeComponent(tile, Position{}).data();
-                pos.y = i*tileWidth+tileWidth/2;
-                pos.x = j*tileWidth+tileWidth/2;
+            Solid tile;
+            tile.rect.left = -tileWidth/2;
+            tile.rect.right = tileWidth/2;
+            tile.rect.bottom = -tileWidth/2;
+            tile.rect.top = tileWidth/2;
 
-                auto& sprite = entities.makeComponent(tile, Sprite{}).data();
-                sprite.name = "tile";
+            Position back;
+            back.z = -1;
 
-                if (lvl.at(0,i,j) == 1)
-                {
-                    sprite.anim = "bricks";
+            auto brick = entities.makePrefab(
+                makeSprite("tile", "bricks"), Position{}, tile);
+            auto backdrop = entities.makePrefab(
+                makeSprite("tile", "background"), back);
+
+            auto next = begin(bricks);
+            auto place = [&](EntID, Position& pos)
+            {
+                pos.y = next->first*tileWidth+tileWidth/2;
+                pos.x = next->second*tileWidth+tileWidth/2;
+                ++next;
+            };
+
+            entities.instantiate<Position>(brick, bricks.size(), place);
+
+            next = begin(background);
+            entities.instantiate<Position>(backdrop, background.size(), place);
+        }
+    }
+
+    PlayerAI Game::makePlayerAI()
+    {
+        PlayerAI ai;
+        ai.setInput(PlayerAI::LEFT,  iface->key(Interface::ivkArrow('L')));
+        ai.setInput(PlayerAI::RIGHT, iface->key(Interface::ivkArrow('R')));
+        ai.setInput(PlayerAI::DOWN,  iface->key(Interface::ivkArrow('D')));
+        ai.setInput(PlayerAI::UP,    iface->key(Interface::ivkArrow('U')));
+        return ai;
+    }
+
+    void Game::registerSerializers()
+    {
+        using Ginseng::Reader;
+        using Ginseng::Writer;
+
+        // Position, Velocity, Solid and CamLook are saved as raw bytes.
+
+        // Sprites save the ticks left in their frame, since the tick count
+        // starts over each run.
+        entities.serializer<Sprite>(
+            [this](Writer& out, Sprite const& sprite)
+            {
+                out.text(sprite.name);
+                out.text(sprite.anim);
+                out.value(sprite.anim_frame);
+                out.value(sprite.next_frame - ticks);
+                out.value(sprite.offset);
+            },
+            [this](Reader& in)
+            {
+                Sprite sprite;
+                sprite.name = in.text();
+                sprite.anim = in.text();
+                sprite.anim_frame = in.value<decltype(sprite.anim_frame)>();
+                sprite.next_frame = ticks + in.value<int>();
+                sprite.offset = in.value<decltype(sprite.offset)>();
+                return sprite;
+            });
+
+        // Brains are saved by kind. Senses are refilled every tick, and the
+        // player's inputs are bound to this window again.
+
+        enum Brain : uint8_t
+        {
+            PLAYER,
+            GOOMBA
+        };
 
-                    auto& solid = entities.makeComponent(tile, Solid{}).data();
-                    solid.rect.left = -tileWidth/2;
-                    solid.rect.right = tileWidth/2;
-                    solid.rect.bottom = -tileWidth/2;
-                    solid.rect.top = tileWidth/2;
+        entities.serializer<AI>(
+            [](Writer& out, AI const& ai)
+            {
+                if (auto goomba = ai.getBrain<GoombaAI>())
+                {
+                    out.value(GOOMBA);
+                    out.value(goomba->dir);
+                }
+                else if (ai.brainEq<PlayerAI>())
+                {
+                    out.value(PLAYER);
                 }
                 else
                 {
-                    sprite.anim = "background";
-
-                    pos.z = -1;
+                    throw logic_error("Game: Unknown AI brain!");
                 }
-            }
-        }
+            },
+            [this](Reader& in)
+            {
+                if (in.value<Brain>() == GOOMBA)
+                {
+                    GoombaAI goomba;
+                    goomba.dir = in.value<int>();
+                    return AI{goomba};
+                }
+
+                return AI{makePlayerAI()};
+            });
     }
 
 // Resource and Configuration Functions
@@ -224,6 +386,8 @@ using namespace Component;
             data.width = width;
             data.height = height;
 
+            spriteReach = max(spriteReach, max(width, height) / 2.0);
+
             for (auto const& anim : anims)
             {
                 auto anim_name = anim.first.as<string>();
@@ -247,11 +411,18 @@ using namespace Component;
         }
     }
 
-// Tick Functions
+// Frame Functions
 
-    void Game::tick()
+    /* Each frame, the world is published to the scene, and then the next
+     * tick runs on another thread while the scene is drawn. Only the frame
+     * boundary, where neither is running, touches both.
+     */
+    void Game::step()
     {
-        auto _ = profiler->scope("Game::tick()");
+        auto _ = profiler->scope("Game::step()");
+
+        // Rethrows anything the last tick threw.
+        simulation.wait();
 
         iface->poll();
 
@@ -263,27 +434,74 @@ using namespace Component;
             return;
         }
 
-        for (auto&& ent : entities.query<AI>())
+        Rect view = findView();
+
+        present(view);
+
+        simulation.run([this]{ tick(); });
+
+        draw(view);
+    }
+
+    void Game::present(Rect view)
+    {
+        auto _ = profiler->scope("Game::present()");
+
+        entities.publish(scene);
+
+        // Only Entities whose sprites might reach into view are drawn.
+        Rect reach = view;
+        reach.left   -= spriteReach;
+        reach.right  += spriteReach;
+        reach.bottom -= spriteReach;
+        reach.top    += spriteReach;
+
+        visible = entities.index<SpatialIndex>().queryRect(reach);
+    }
+
+// Tick Functions
+
+    void Game::tick()
+    {
+        auto _ = profiler->scope("Game::tick()");
+
+        auto REWIND = iface->key(Interface::ivk('R'));
+
+        if (REWIND)
         {
-            auto& ai = get<1>(ent).data();
-            ai.clearSenses();
+            if (history.size() > 1)
+            {
+                history.pop_back();
+                ticks = history.back().first;
+                entities.restore(history.back().second);
+            }
+
+            return;
         }
 
-        runPhysics();
-        procAIs();
-        slaughter();
+        ++ticks;
+        systems.run();
+
+        if (iface->key(Interface::ivkFunc(5)).pressed())
+            entities.save(saveFile);
+
+        if (iface->key(Interface::ivkFunc(6)).pressed())
+            compactMemory();
+
+        history.emplace_back(ticks, entities.snapshot());
+
+        if (history.size() > 120)
+            history.pop_front();
     }
 
     void Game::procAIs()
     {
         auto _ = profiler->scope("Game::procAIs()");
 
-        for (auto&& ent : entities.query<AI>())
+        entities.for_each<AI>([&](EntID eid, AI& ai)
         {
-            auto& e = get<0>(ent);
-            auto& ai = get<1>(ent).data();
-            ai.proc(*this, e);
-        }
+            ai.proc(*this, eid);
+        });
     }
 
     void Game::runPhysics()
@@ -292,9 +510,10 @@ using namespace Component;
 
         auto _ = profiler->scope("Game::runPhysics()");
 
-        auto const& ent_pos_vel_sol = entities.query<Position,Velocity,Solid>();
-        auto const& ent_vel_sol = entities.query<Velocity,Solid>();
-        auto const& ent_pos_sol = entities.query<Position,Solid>();
+        // Only write access marks components as changed, so read-only terms
+        // are const to keep static tiles out of change-tracking queries.
+        auto ent_pos_vel_sol = entities.view<Position,Velocity,Solid const>();
+        auto ent_pos_sol = entities.view<Position const,Solid const>();
 
         auto getRect = [](Position const& pos, Solid const& solid)
         {
@@ -336,17 +555,17 @@ using namespace Component;
 
         {
             auto _ = profiler->scope("Gravity");
-            for (auto& ent : ent_vel_sol)
-            {
-                auto& vel = get<1>(ent).data();
-                vel.vy -= 0.5;
-            }
+            entities.par_for_each<Velocity,Solid const>(
+                [](EntID, Velocity& vel, Solid const&)
+                {
+                    vel.vy -= 0.5;
+                });
         }
 
         {
             auto _ = profiler->scope("Collision");
 
-            for (auto& ent : ent_pos_vel_sol)
+            for (auto&& ent : ent_pos_vel_sol)
             {
                 auto& eid   = get<0>(ent);
                 auto& pos   = get<1>(ent).data();
@@ -365,7 +584,7 @@ using namespace Component;
                     int hit = 0;
                     auto aabb = getRect(pos, solid);
 
-                    for (auto& other : ent_pos_sol)
+                    for (auto&& other : ent_pos_sol)
                     {
                         auto& eid2   = get<0>(other);
                         auto& pos2   = get<1>(other).data();
@@ -451,33 +670,86 @@ using namespace Component;
     {
         auto _ = profiler->scope("Game::slaughter()");
 
-        auto const& ents = entities.query<KillMe>();
+        entities.for_each<KillMe>([&](EntID eid, KillMe&)
+        {
+            commands.destroy(eid);
+        });
+
+        entities.flush(commands);
+    }
+
+    void Game::compactMemory()
+    {
+        auto _ = profiler->scope("Game::compactMemory()");
+
+        auto released = entities.compact();
+        auto stats = entities.memoryStats();
+
+        logger->log("Memory: ", stats.bytes, " bytes for ", stats.entities,
+                    " entities; compact() released ", released, " bytes.");
+
+        auto report = [](char const* name,
+                         ECDatabase::ComponentStats const& com)
+        {
+            logger->log("    ", name, ": ", com.count, " of ", com.capacity,
+                        " in ", com.bytes, " bytes, ",
+                        int(com.fragmentation() * 100), "% unused.");
+        };
+
+        report("AI", entities.componentStats<AI>());
+        report("CamLook", entities.componentStats<CamLook>());
+        report("KillMe", entities.componentStats<KillMe>());
+        report("Position", entities.componentStats<Position>());
+        report("Solid", entities.componentStats<Solid>());
+        report("Sprite", entities.componentStats<Sprite>());
+        report("Velocity", entities.componentStats<Velocity>());
+    }
+
+    void Game::animateSprites()
+    {
+        auto _ = profiler->scope("Game::animateSprites()");
+
+        // Only sprites that change frame are written, so that snapshots
+        // keep sharing the pages of the rest.
+        entities.for_each<Sprite const>([&](EntID eid, Sprite const& cur)
+        {
+            if (cur.next_frame > ticks)
+                return;
+
+            auto const& anim = sprites.get(cur.name).anims.get(cur.anim);
+
+            if (anim.size() == 1 && cur.anim_frame == 0)
+                return;
 
-        for (auto& ent : ents)
-            entities.eraseEntity(get<0>(ent));
+            auto& spr = eid.get<Sprite>().data();
+
+            ++spr.anim_frame;
+            if (spr.anim_frame >= anim.size())
+                spr.anim_frame = 0;
+            spr.next_frame = ticks + anim[spr.anim_frame].duration;
+
+            entities.markChanged<Sprite>(eid);
+        });
     }
 
 // Draw Functions
 
-    void Game::draw()
+    void Game::draw(Rect view)
     {
         auto _ = profiler->scope("Game::draw()");
 
         beginFrame();
 
-        Rect view = setupCamera();
+        setupCamera(view);
 
         drawSprites(view);
 
         endFrame();
     }
 
-    Rect Game::setupCamera()
+    Rect Game::findView()
     {
-        auto _ = profiler->scope("Game::setupCamera()");
-
-        Camera cam;
-        cam.depthTest = true;
+        auto _ = profiler->scope("Game::findView()");
 
         Rect rv;
 
@@ -488,16 +760,14 @@ using namespace Component;
             view.right = numeric_limits<decltype(view.right)>::lowest();
             view.top = view.right;
 
-            for (auto& ent : entities.query<Position, CamLook>())
+            entities.for_each<Position const, CamLook const>(
+                [&](EntID, Position const& pos, CamLook const& cam)
             {
-                auto& pos = get<1>(ent).data();
-                auto& cam = get<2>(ent).data();
-
                 view.left   = min(view.left,   pos.x + cam.aabb.left);
                 view.bottom = min(view.bottom, pos.y + cam.aabb.bottom);
                 view.right  = max(view.right,  pos.x + cam.aabb.right);
                 view.top    = max(view.top,    pos.y + cam.aabb.top);
-            }
+            });
 
             struct
             {
@@ -549,42 +819,51 @@ using namespace Component;
             rv.right = scam.x+hw;
             rv.bottom = scam.y-hh;
             rv.top = scam.y+hh;
-
-            cam.ortho(rv.left, rv.right, rv.bottom, rv.top, -10, 10);
         }
 
-        applyCam(cam);
-
         return rv;
     }
 
+    void Game::setupCamera(Rect view)
+    {
+        auto _ = profiler->scope("Game::setupCamera()");
+
+        Camera cam;
+        cam.depthTest = true;
+        cam.ortho(view.left, view.right, view.bottom, view.top, -10, 10);
+
+        applyCam(cam);
+    }
+
     void Game::drawSprites(Rect view)
     {
         auto _ = profiler->scope("Game::drawSprites()");
 
         Transform mat;
 
-        auto const& ents = entities.query<Position, Sprite>();
-        using Ent = decltype(&ents[0]);
-
         struct DrawItem
         {
-            Ent ent;
+            Position const* pos;
             function<void()> draw;
 
-            DrawItem(Ent e, function<void()> f)
-                : ent(e)
+            DrawItem(Position const* p, function<void()> f)
+                : pos(p)
                 , draw(move(f))
             {}
         };
 
         vector<DrawItem> items;
 
-        for (auto const& ent : ents)
+        // The next tick is running, so only the scene may be read.
+        for (auto eid : visible)
         {
-            auto& pos = get<1>(ent).data();
-            auto& spr = get<2>(ent).data();
+            auto sprptr = scene.get<Sprite>(eid);
+
+            if (!sprptr)
+                continue;
 
+            auto const& pos = *scene.get<Position>(eid);
+            auto const& spr = *sprptr;
             auto const& sprdata = sprites.get(spr.name);
 
             Rect aabb;
@@ -598,7 +877,7 @@ using namespace Component;
             && aabb.bottom<view.top
             && aabb.top>view.bottom)
             {
-                items.emplace_back(&ent, [&]
+                items.emplace_back(&pos, [this, &mat, &pos, &spr, &sprdata]
                 {
                     auto _ = mat.scope_push();
 
@@ -607,15 +886,9 @@ using namespace Component;
                     mat.translate(int(pos.x+spr.offset.x), int(pos.y+spr.offset.y), pos.z);
                     modelMatrix(mat);
 
-                    if (--spr.ticker <= 0)
-                    {
-                        ++spr.anim_frame;
-                        if (spr.anim_frame >= anim.size())
-                            spr.anim_frame = 0;
-                        spr.ticker = anim[spr.anim_frame].duration;
-                    }
-
-                    auto const& frame = anim[spr.anim_frame];
+                    // Sprites are not animated until their first tick.
+                    auto const& frame = anim[spr.anim_frame < anim.size()
+                                             ? spr.anim_frame : 0];
 
                     sprdata.sheet.draw(frame.r, frame.c);
                 });
@@ -624,8 +897,8 @@ using namespace Component;
 
         sort(begin(items), end(items), [](DrawItem const& a, DrawItem const& b)
         {
-            auto& posa = get<1>(*a.ent).data();
-            auto& posb = get<1>(*b.ent).data();
+            auto& posa = *a.pos;
+            auto& posb = *b.pos;
             return (tie(posa.z,posa.x,posa.y) < tie(posb.z,posb.x,posb.y));
         });
 
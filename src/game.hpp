@@ -5,17 +5,24 @@
 #include "inugami/texture.hpp"
 #include "inugami/spritesheet.hpp"
 
+#include "ginseng/scheduler.hpp"
 #include "puddle/puddle.hpp"
 
+#include "component.position.hpp"
+#include "component.sprite.hpp"
 #include "resourcepool.hpp"
 #include "spritedata.hpp"
 #include "rect.hpp"
 #include "smoothcamera.hpp"
 #include "types.hpp"
+#include "worker.hpp"
 
+#include <deque>
 #include <memory>
 #include <random>
+#include <string>
 #include <utility>
+#include <vector>
 
 class Game
 	: public Inugami::Core
@@ -24,6 +31,9 @@ class Game
 
         int tileWidth = 32;
 
+        // Written by F5, and loaded at startup if present.
+        std::string saveFile = "world.sav";
+
         struct
         {
             double width;
@@ -37,6 +47,9 @@ class Game
         ResourcePool<Inugami::Texture> textures;
         ResourcePool<SpriteData> sprites;
 
+        // Half the width or height of the largest sprite.
+        double spriteReach = 0;
+
     // Support
 
         std::mt19937 rng;
@@ -47,6 +60,35 @@ public:
 
         ECDatabase entities;
 
+        // Structural changes made while systems run, applied at sync points.
+        ECDatabase::CommandBuffer commands;
+
+    // Systems
+
+        Ginseng::Scheduler systems;
+
+    // History
+
+        // Ticks run so far, which time sprite animations.
+        int ticks = 0;
+
+        // Snapshots taken after each of the last 120 ticks, oldest first,
+        // with the tick count at each. Holding R rewinds through them.
+        std::deque<std::pair<int, ECDatabase::Snapshot>> history;
+
+    // Frame
+
+        // What draw() sees of the world, published at each frame boundary,
+        // so that the next tick can run while the frame is drawn.
+        ECDatabase::FrontBuffer<Component::Position, Component::Sprite> scene;
+
+        // Entities whose sprites might be in view, as of the last publish.
+        std::vector<ECDatabase::EntID> visible;
+
+        // Runs each tick alongside the frame after it. Declared last, so
+        // that it is stopped before anything a tick uses is destroyed.
+        Worker simulation;
+
     // Initialization
 
         Game(RenderParams params);
@@ -54,6 +96,17 @@ public:
         void loadTextures();
         void loadSprites();
 
+    // World Functions
+
+        void buildWorld();
+        Component::PlayerAI makePlayerAI();
+        void registerSerializers();
+
+    // Frame Functions
+
+        void step();
+        void present(Rect view);
+
     // Tick Functions
 
         void tick();
@@ -61,12 +114,15 @@ public:
         void procAIs();
         void runPhysics();
         void slaughter();
+        void compactMemory();
+        void animateSprites();
 
     // Draw Functions
 
-        void draw();
+        void draw(Rect view);
 
-        Rect setupCamera();
+        Rect findView();
+        void setupCamera(Rect view);
         void drawSprites(Rect view);
 };
 
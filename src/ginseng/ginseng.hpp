@@ -2,13 +2,29 @@
 #define GINSENG_GINSENG_HPP
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <functional>
 #include <type_traits>
 #include <vector>
-#include <list>
+#include <limits>
+#include <unordered_map>
+#include <bitset>
+#include <cmath>
 #include <iterator>
 #include <tuple>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "mapping.hpp"
+#include "threadpool.hpp"
 
 namespace Ginseng {
 
@@ -18,17 +34,9 @@ namespace _detail {
 
 // Forward Declarations
 
-    template <template <typename> class AllocatorT>
+    template <template <typename> class AllocatorT, typename ComponentList>
     class Database;
 
-// http://stackoverflow.com/a/10669041/640397
-
-    template <typename C, typename CI>
-    typename C::iterator make_mutable_iterator(C& container, CI&& iter)
-    {
-        return container.erase(iter, iter);
-    }
-
 // Traits
 
     // PointerToReference
@@ -148,101 +156,230 @@ namespace _detail {
             using type = TypeList<U<Ts>...>;
         };
 
+// Components
+
+    /*! Component list
+     *
+     * Lists the component types known to a Database at compile time.
+     * Each listed type gets a constant GUID equal to its position in the
+     * list.
+     *
+     * @tparam Ts Component types.
+     */
+    template <typename... Ts>
+    struct Components
+    {};
+
+    // ComponentIndex
+
+        // Position of T in a Components list, or -1 if it is not listed.
+        template <typename T, typename List>
+        struct ComponentIndex;
+
+        template <typename T>
+        struct ComponentIndex<T, Components<>>
+            : integral_constant<ptrdiff_t, -1>
+        {};
+
+        template <typename T, typename... Us>
+        struct ComponentIndex<T, Components<T, Us...>>
+            : integral_constant<ptrdiff_t, 0>
+        {};
+
+        template <typename T, typename U, typename... Us>
+        struct ComponentIndex<T, Components<U, Us...>>
+            : integral_constant<ptrdiff_t,
+                (ComponentIndex<T, Components<Us...>>::value < 0
+                    ? -1
+                    : ComponentIndex<T, Components<Us...>>::value + 1)>
+        {};
+
 // GUID
 
     using GUID = int_fast64_t;
 
-    inline GUID& instGUID()
+// Version
+
+    // Change-tracking clock. Every written component is stamped with it.
+    using Version = uint32_t;
+
+// QueryID
+
+    // IDs are handed out on first use, which may happen on any thread.
+    inline size_t nextQueryID()
     {
-        static GUID guid = 0;
-        return guid;
+        static atomic<size_t> id {0};
+        return id++;
     }
 
-    inline GUID nextGUID()
+    template <typename... Ts>
+    size_t getQueryID()
     {
-        GUID rv = ++instGUID();
-        if (rv == numeric_limits<GUID>::max())
-            throw;
-        return rv;
+        static size_t id = nextQueryID();
+        return id;
     }
 
-    template <typename T>
-    GUID getGUID()
+// IndexID
+
+    inline size_t nextIndexID()
     {
-        static GUID guid = nextGUID();
-        return guid;
+        static atomic<size_t> id {0};
+        return id++;
     }
 
-// Component
+    template <typename I>
+    size_t getIndexID()
+    {
+        static size_t id = nextIndexID();
+        return id;
+    }
 
-    template <typename T>
-    class Component
+// ComponentMask
+
+    // Maximum number of distinct component types in a program.
+    constexpr size_t MAX_COMPONENT_TYPES = 256;
+
+    /* A set of component types, one bit per GUID.
+     * Matching a query against an archetype is a handful of word-wide ANDs.
+     */
+    using ComponentMask = bitset<MAX_COMPONENT_TYPES>;
+
+    inline void addToMask(ComponentMask& mask, GUID guid)
+    {
+        if (size_t(guid) >= MAX_COMPONENT_TYPES)
+            throw length_error("Ginseng: Too many component types!");
+        mask.set(guid);
+    }
+
+
+// TypeInfo
+
+    /* Type-erased operations for a component type.
+     * Columns and ComponentData only know their element type through this
+     * table; it is the only indirection left on the storage paths.
+     */
+    struct TypeInfo
     {
-        T val;
+        GUID guid;
+        size_t size;
 
-        Component(Component const&) = delete;
-        Component(Component &&) noexcept = delete;
-        Component& operator=(Component const&) = delete;
-        Component& operator=(Component &&) noexcept = delete;
+        // Empty types are tags, which are never stored in columns.
+        bool tag;
 
-        public:
+        // Trivially copyable types are saved as raw bytes.
+        bool trivial;
 
-            Component(T t)
-                : val(move(t))
-            {}
+        // Move-constructs dst from src, then destroys src.
+        void (*relocate)(void* dst, void* src);
 
-            T& getVal()
-            {
-                return val;
-            }
-    };
+        void (*destroy)(void* ptr);
 
-    using AbstractComponent = void;
+        // Moves src into a newly allocated box. src is left alive.
+        void* (*box)(void* src);
 
-// GUIDPair
+        // Move-constructs dst from the contents of a box.
+        void (*unbox)(void* dst, void* box);
 
-    template <typename T>
-    class GUIDPair
+        // Move-assigns the contents of a box to dst.
+        void (*assign)(void* dst, void* box);
+
+        // Destroys and deallocates a box.
+        void (*freeBox)(void* box);
+
+        // Copy-constructs dst from src. Null if T is not copyable.
+        void (*copy)(void* dst, void const* src);
+
+        // Makes the box allocator release memory it holds but does not use.
+        // Returns the bytes released.
+        size_t (*trimBoxes)();
+    };
+
+// ComponentData
+
+    /*! Component Data
+     *
+     * A single component that is owned outside of any Database, as returned
+     * by Database::displaceComponent().
+     *
+     * The component is stored as exactly one `T`, allocated by the owning
+     * Database's allocator. There is no reference count; ComponentData is
+     * move-only.
+     */
+    class ComponentData
     {
-        pair<GUID,T> val;
+        template <template <typename> class AllocatorT, typename ComponentList>
+        friend class Database;
+
+        TypeInfo const* info = nullptr;
+        void* ptr = nullptr;
+
+        ComponentData(TypeInfo const* i, void* p) noexcept
+            : info(i)
+            , ptr(p)
+        {}
 
         public:
 
-            GUIDPair(GUID guid, T t)
-                : val(guid, move(t))
-            {}
+            ComponentData() = default;
+            ComponentData(ComponentData const&) = delete;
+            ComponentData& operator=(ComponentData const&) = delete;
 
-            GUID getGUID() const noexcept
+            ComponentData(ComponentData && other) noexcept
+                : info(other.info)
+                , ptr(other.ptr)
             {
-                return val.first;
+                other.info = nullptr;
+                other.ptr = nullptr;
             }
 
-            T const& getVal() const noexcept
+            ComponentData& operator=(ComponentData && other) noexcept
             {
-                return val.second;
+                swap(info, other.info);
+                swap(ptr, other.ptr);
+                return *this;
             }
-    };
 
-    template <typename T>
-    constexpr bool operator<(GUIDPair<T>const& a, GUIDPair<T>const& b) noexcept
-    {
-        return a.getGUID() < b.getGUID();
-    }
+            ~ComponentData()
+            {
+                if (ptr)
+                    info->freeBox(ptr);
+            }
 
-    template <typename T>
-    constexpr bool operator<(GUIDPair<T> const& a, GUID guid) noexcept
-    {
-        return a.getGUID() < guid;
-    }
+            /*! Test for validity.
+             *
+             * @return True if this holds a component.
+             */
+            explicit operator bool() const noexcept
+            {
+                return ptr;
+            }
+
+            /*! Get the component's GUID.
+             *
+             * @warning
+             * Behaviour is undefined if this ComponentData is empty.
+             *
+             * @return GUID of the component's type.
+             */
+            GUID getGUID() const noexcept
+            {
+                return info->guid;
+            }
+    };
 
 // Entity
 
+    /*! Detached Entity
+     *
+     * Holds the components of an Entity that has been displaced out of a
+     * Database, sorted by GUID.
+     */
     class Entity
     {
-        template <template <typename> class AllocatorT>
+        template <template <typename> class AllocatorT, typename ComponentList>
         friend class Database;
 
-        using ComponentData = GUIDPair<shared_ptr<AbstractComponent>>;
+        using ComponentData = _detail::ComponentData;
         using ComponentVec = vector<ComponentData>;
 
         ComponentVec components;
@@ -256,693 +393,6141 @@ namespace _detail {
             Entity& operator=(Entity &&) = default;
     };
 
-// Queries
+// Serialization
 
-    // Not
+    /*! Save File Writer
+     *
+     * Appends to a file written by Database::save(). Custom component
+     * serializers write each component through it.
+     */
+    class Writer
+    {
+        template <template <typename> class AllocatorT, typename ComponentList>
+        friend class Database;
 
-        template <typename... Ts>
-        struct Not
-        {};
+        FILE* file;
+        uint64_t offset = 0;
 
-        // IsNot
+        explicit Writer(FILE* f)
+            : file(f)
+        {}
 
-            template <typename T>
-            struct IsNot : false_type
-            {};
+        // Pads with zeros to the alignment of component pages.
+        void pad()
+        {
+            static unsigned char const zeros[alignof(max_align_t)] = {};
 
-            template <typename... Ts>
-            struct IsNot<Not<Ts...>> : true_type
-            {};
+            if (offset % sizeof(zeros) != 0)
+                bytes(zeros, sizeof(zeros) - offset % sizeof(zeros));
+        }
 
-        // FlattenNots
+        public:
 
-            template <typename T>
-            struct FlattenNots;
+            /*! Write raw bytes.
+             *
+             * @param data Bytes to write.
+             * @param size Number of bytes.
+             */
+            void bytes(void const* data, size_t size)
+            {
+                if (size != 0 && fwrite(data, 1, size, file) != size)
+                    throw runtime_error("Ginseng: Failed to write save file!");
 
-            template <typename T>
-            using FlattenNots_t = typename FlattenNots<T>::type;
+                offset += size;
+            }
 
-            template <typename... Ts, typename... Us>
-            struct FlattenNots<TypeList<Not<Ts...>, Us...>>
+            /*! Write a trivially copyable value.
+             *
+             * @param val Value to write.
+             */
+            template <typename T>
+            void value(T const& val)
             {
-                using type = TypeListCat_t<TypeList<Ts...>,
-                    FlattenNots_t<TypeList<Us...>>>;
-            };
+                static_assert(is_trivially_copyable<T>::value,
+                    "Ginseng: Only trivially copyable values can be written.");
 
-            template <>
-            struct FlattenNots<TypeList<>>
+                bytes(&val, sizeof(T));
+            }
+
+            /*! Write a string.
+             *
+             * @param str String to write, prefixed by its length.
+             */
+            void text(string const& str)
             {
-                using type = TypeList<>;
-            };
+                value(uint64_t(str.size()));
+                bytes(str.data(), str.size());
+            }
+    };
 
-    // IsPositive
+    /*! Save File Reader
+     *
+     * Reads a memory-mapped file written by Database::save(). Custom
+     * component serializers read each component through it.
+     */
+    class Reader
+    {
+        template <template <typename> class AllocatorT, typename ComponentList>
+        friend class Database;
 
-        template <typename T>
-        struct IsPositive : true_type
-        {};
+        unsigned char* pos;
+        unsigned char* last;
 
-        template <typename... Ts>
-        struct IsPositive<Not<Ts...>> : false_type
-        {};
+        Reader(unsigned char* first, unsigned char* l)
+            : pos(first)
+            , last(l)
+        {}
 
-    // QueryTraits
+        // Skips to the alignment of component pages. Mappings start at a
+        // page boundary, so file offsets and addresses agree.
+        void pad()
+        {
+            auto align = alignof(max_align_t);
+            auto addr = reinterpret_cast<uintptr_t>(pos);
+            take((align - addr % align) % align);
+        }
 
-        template <typename DB, typename... Ts>
-        struct QueryTraits
+        unsigned char* take(uint64_t size)
         {
-            using types = TypeList<Ts...>;
-            using components = TypeListFilter_t<types, IsPositive>;
+            if (uint64_t(last - pos) < size)
+                throw runtime_error("Ginseng: Save file is truncated!");
 
-            using EntID = typename DB::EntID;
-            using ComID = typename DB::ComID;
+            auto rv = pos;
+            pos += size;
+            return rv;
+        }
 
-            template <typename T>
-            using Ref = typename add_lvalue_reference<T>::type;
+        public:
 
-            template <typename T>
-            using Ptr = T*;
+            /*! Read raw bytes.
+             *
+             * @param data Destination.
+             * @param size Number of bytes.
+             */
+            void bytes(void* data, size_t size)
+            {
+                if (size != 0)
+                    memcpy(data, take(size), size);
+            }
 
+            /*! Read a trivially copyable value.
+             *
+             * @return The value.
+             */
             template <typename T>
-            using CIDPair = pair<T,ComID>;
+            T value()
+            {
+                static_assert(is_trivially_copyable<T>::value,
+                    "Ginseng: Only trivially copyable values can be read.");
 
-            template <typename T>
-            using ComInfo = typename DB::template ComInfo<T>;
+                T rv;
+                bytes(&rv, sizeof(T));
+                return rv;
+            }
 
-            using component_dats = TypeListImbue_t<components, ComInfo>;
+            /*! Read a string written by Writer::text().
+             *
+             * @return The string.
+             */
+            string text()
+            {
+                auto size = value<uint64_t>();
+                auto data = take(size);
+                return string(data, data + size);
+            }
+    };
 
-            using result_item = TypeListCat_t<TypeList<EntID>,component_dats>;
-            using result_element = TypeListTuple_t<result_item>;
+// Column
+
+    /* Storage for one component type of an Archetype.
+     * Elements are kept in fixed-size pages, one page per archetype chunk, so
+     * growing a column never moves existing elements.
+     *
+     * Pages are reference counted so that snapshots can share them. A shared
+     * page is never written; own() gives the column a private copy first.
+     * Whoever releases the last reference destroys the page's elements.
+     *
+     * Pages normally come from the heap, right after their headers, but
+     * may also be adopted in place from a MappedFile. Their headers are then
+     * allocated apart, so that the mapping is never written.
+     */
+    class Column
+    {
+        // Keeps the elements of heap pages, which follow it, maximally
+        // aligned.
+        struct alignas(max_align_t) PageHeader
+        {
+            atomic<size_t> refs;
 
-            using result = vector<result_element>;
+            // The mapping that holds the page, or null for the heap.
+            MappedFile* backing;
 
-            using nots = FlattenNots_t<TypeListFilter_t<types, IsNot>>;
+            unsigned char* data;
+        };
 
-            // fillInfo
+        TypeInfo const* info;
+        size_t size;
+        size_t shift;
+        size_t mask;
 
-                template <size_t I=1>
-                static typename enable_if<
-                    I < tuple_size<result_element>::value,
-                bool>::type fillInfo(EntID eid, result_element& ele)
-                {
-                    using TE = typename tuple_element<I,result_element>::type;
-                    using Com = typename TE::type;
+        // Number of constructed rows.
+        size_t count = 0;
 
-                    auto& info = get<I>(ele);
+        // Queries are const, but writing through them may still swap a
+        // shared page for a private copy. Page data is kept beside the
+        // headers, so that element access does not read them.
+        mutable vector<PageHeader*> headers;
+        mutable vector<unsigned char*> pages;
 
-                    info = eid.template get<Com>();
+        // Whether each page is known to be private, which saves reading its
+        // header on every write.
+        mutable vector<unsigned char> owned;
 
-                    if (!info) return false;
+        // Version of the last write to each row, and the newest per page.
+        // Stamps are bookkeeping, so const readers may still stamp writes.
+        mutable vector<Version> versions;
+        mutable vector<Version> pageVersions;
 
-                    return fillInfo<I+1>(eid,ele);
-                }
+        // Makes room for count more elements, growing geometrically.
+        template <typename V>
+        static void reserveMore(V& vec, size_t count)
+        {
+            if (vec.capacity() - vec.size() < count)
+                vec.reserve(max(vec.capacity() * 2, vec.size() + count));
+        }
 
-                template <size_t I=1>
-                static typename enable_if<
-                    I >= tuple_size<result_element>::value,
-                bool>::type fillInfo(EntID eid, result_element& ele)
-                {
-                    return true;
-                }
-        };
+        // Allocates a page of bytes, in a mapping if backing is not null.
+        static PageHeader* makeHeader(size_t bytes, MappedFile* backing,
+                                      unsigned char* data)
+        {
+            auto raw = ::operator new(sizeof(PageHeader) + bytes);
+            auto rv = ::new (raw) PageHeader();
+            rv->refs = 1;
+            rv->backing = backing;
+            rv->data = (backing ? data : reinterpret_cast<unsigned char*>(
+                rv + 1));
 
-        // QueryResult_t
+            if (backing)
+                backing->retain();
 
-            template <typename DB, typename... Ts>
-            using QueryResult_t = typename QueryTraits<DB, Ts...>::result;
+            return rv;
+        }
 
-    // QueryHelper
+        PageHeader* allocPage() const
+        {
+            return makeHeader((mask + 1) * size, nullptr, nullptr);
+        }
 
-        // getComs
+        // Drops a reference to a page, which holds rows elements.
+        void releasePage(PageHeader* page, size_t rows) const
+        {
+            if (--page->refs != 0)
+                return;
 
-            template <typename T>
-            struct QueryHelper_getComs;
+            for (size_t i=0; i<rows; ++i)
+                info->destroy(page->data + i * size);
 
-            template <typename... Ts>
-            struct QueryHelper_getComs<TypeList<Ts...>>
-            {
-                template <typename EID>
-                static auto getComs(EID eid)
-                -> decltype(eid.template getComs<Ts...>())
-                {
-                    return eid.template getComs<Ts...>();
-                }
-            };
+            auto backing = page->backing;
+            page->~PageHeader();
+            ::operator delete(page);
 
-        // noNots
+            if (backing)
+                backing->release();
+        }
 
-            template <typename T>
-            struct QueryHelper_noNots;
+        // Number of elements in page when the column holds n.
+        size_t rowsIn(size_t page, size_t n) const
+        {
+            auto first = page << shift;
+            return (n > first ? min(n - first, mask + 1) : 0);
+        }
 
-            template <typename T, typename... Ts>
-            struct QueryHelper_noNots<TypeList<T, Ts...>>
-            {
-                template <typename EID>
-                static bool noNots(EID eid)
-                {
-                    T* ptr = eid.template get<T>().first;
-                    if (ptr) return false;
-                    return QueryHelper_noNots<TypeList<Ts...>>::noNots(eid);
-                }
-            };
+        // Slow path of ownPage().
+        void claimPage(size_t page) const
+        {
+            auto& ptr = headers[page];
 
-            template <>
-            struct QueryHelper_noNots<TypeList<>>
+            if (ptr->refs == 1)
             {
-                template <typename EID>
-                static bool noNots(EID eid)
-                {
-                    return true;
-                }
-            };
+                owned[page] = true;
+                return;
+            }
 
-/*! Database
- *
- * An Entity component Database. Uses the given allocator to allocate
- * components, and may also use the same allocator for internal data.
- *
- * @warning
- * This container does not perform any synchronization. Therefore, it is not
- * considered "thread-safe".
- *
- * @tparam AllocatorT Component allocator.
- */
-template <template <typename> class AllocatorT = allocator>
-class Database
-{
-    template <typename T>
-    using AllocList = list<T, AllocatorT<T>>;
+            if (!info->copy)
+                throw logic_error("Ginseng: Component is not copyable!");
 
-    AllocList<Entity> entities;
+            auto rows = rowsIn(page);
+            auto copy = allocPage();
+            size_t i = 0;
 
-    public:
+            try
+            {
+                for (; i<rows; ++i)
+                    info->copy(copy->data + i * size, ptr->data + i * size);
+            }
+            catch (...)
+            {
+                while (i-- > 0)
+                    info->destroy(copy->data + i * size);
+                releasePage(copy, 0);
+                throw;
+            }
 
-    // IDs
+            releasePage(ptr, rows);
+            ptr = copy;
+            pages[page] = copy->data;
+            owned[page] = true;
+        }
 
-        // forward declarations needed for EntID
+        public:
 
-            class ComID;
+            Column(TypeInfo const* i, size_t chunkShift)
+                : info(i)
+                , size(i->size)
+                , shift(chunkShift)
+                , mask((size_t(1) << chunkShift) - 1)
+            {}
 
-            template <typename Com>
-            class ComInfo;
+            Column(Column const&) = delete;
+            Column(Column &&) noexcept = default;
+            Column& operator=(Column const&) = delete;
+            Column& operator=(Column &&) = delete;
 
-        /*! Entity ID
-         *
-         * A handle to an Entity. Very lightweight.
-         */
-        class EntID
-        {
-            friend class Database;
+            ~Column()
+            {
+                for (size_t i=0; i<headers.size(); ++i)
+                    releasePage(headers[i], rowsIn(i));
+            }
 
-            typename AllocList<Entity>::const_iterator iter;
+            TypeInfo const& getInfo() const
+            {
+                return *info;
+            }
 
-            public:
+            GUID getGUID() const
+            {
+                return info->guid;
+            }
 
-                /*! Query the Entity for a component.
-                 *
-                 * Queries the Entity for the given component type.
-                 * If found, returns a valid ComInfo object for the requested
-                 * component.
-                 * Otherwise, returns an invalid ComInfo object.
-                 *
-                 * @tparam T Explicit type of component.
-                 * @return ComInfo for the requested component.
-                 */
-                template <typename T>
-                ComInfo<T> get() const
-                {
-                    T* ptr = nullptr;
-                    ComID cid;
+            size_t getCount() const
+            {
+                return count;
+            }
 
-                    GUID guid = getGUID<T>();
-                    auto& comvec = iter->components;
+            void* at(size_t row) const
+            {
+                return pages[row >> shift] + (row & mask) * size;
+            }
 
-                    auto pos=lower_bound(begin(comvec), end(comvec), guid);
+            /* Makes page private to this column before it is written,
+             * copying its elements if a snapshot shares it.
+             */
+            void ownPage(size_t page) const
+            {
+                if (!owned[page])
+                    claimPage(page);
+            }
 
-                    cid.eid = *this;
+            void own(size_t row) const
+            {
+                ownPage(row >> shift);
+            }
 
-                    if (pos != end(comvec) && pos->getGUID() == guid)
-                    {
-                        cid.iter = pos;
-                        ptr = &cid.template cast<T>();
-                    }
+            // Address of a row that is about to be written.
+            void* edit(size_t row) const
+            {
+                own(row);
+                return at(row);
+            }
 
-                    return {ptr,cid};
-                }
+            // Counts a row pushed onto the column, owning its page first.
+            void grow()
+            {
+                ownPage(count >> shift);
+                ++count;
+            }
 
-                /*! Query the Entity for multiple components.
-                 *
-                 * Returns a tuple containing results equivalent to multiple
-                 * calls to get().
-                 *
-                 * For example, if `eid.getComs<X,Y,Z>()` is called, it is
+            /* Counts the last row popped from the column.
+             * The caller must already own its page.
+             */
+            void shrink()
+            {
+                --count;
+            }
+
+            Version getVersion(size_t row) const
+            {
+                return versions[row];
+            }
+
+            Version getPageVersion(size_t page) const
+            {
+                return pageVersions[page];
+            }
+
+            // Records a write of version v to row.
+            void touch(size_t row, Version v) const
+            {
+                versions[row] = v;
+                touchPage(row >> shift, v);
+            }
+
+            // Like touch(), but leaves the page stamp to the caller.
+            void stamp(size_t row, Version v) const
+            {
+                versions[row] = v;
+            }
+
+            void touchPage(size_t page, Version v) const
+            {
+                auto& pv = pageVersions[page];
+                pv = max(pv, v);
+            }
+
+            void reservePages(size_t count)
+            {
+                headers.reserve(count);
+                pages.reserve(count);
+                owned.reserve(count);
+                versions.reserve(count << shift);
+                pageVersions.reserve(count);
+            }
+
+            void pushPage()
+            {
+                appendPage(allocPage(), true);
+            }
+
+            /* Appends a page of rows trivially copyable elements, in place
+             * in file, and stamps them with version v.
+             */
+            void adoptPage(unsigned char* data, MappedFile* file, size_t rows,
+                           Version v)
+            {
+                appendPage(makeHeader(0, file, data), true);
+                count += rows;
+                stampPage(pages.size() - 1, rows, v);
+            }
+
+            size_t pageRows() const
+            {
+                return mask + 1;
+            }
+
+            size_t pageBytes() const
+            {
+                return pageRows() * size;
+            }
+
+            // Rows that fit in the allocated pages.
+            size_t capacity() const
+            {
+                return pages.size() << shift;
+            }
+
+            // Bytes of pages, including mapped ones, and bookkeeping.
+            size_t memoryBytes() const
+            {
+                return headers.size() * (sizeof(PageHeader) + pageBytes())
+                    + headers.capacity() * sizeof(PageHeader*)
+                    + pages.capacity() * sizeof(unsigned char*)
+                    + owned.capacity()
+                    + versions.capacity() * sizeof(Version)
+                    + pageVersions.capacity() * sizeof(Version);
+            }
+
+            void shrinkToFit()
+            {
+                headers.shrink_to_fit();
+                pages.shrink_to_fit();
+                owned.shrink_to_fit();
+                versions.shrink_to_fit();
+                pageVersions.shrink_to_fit();
+            }
+
+            size_t pageCount() const
+            {
+                return pages.size();
+            }
+
+            // Number of elements in page.
+            size_t rowsIn(size_t page) const
+            {
+                return rowsIn(page, count);
+            }
+
+            void popPage()
+            {
+                releasePage(headers.back(), rowsIn(pages.size() - 1));
+                headers.pop_back();
+                pages.pop_back();
+                owned.pop_back();
+                versions.resize(versions.size() - (mask + 1));
+                pageVersions.pop_back();
+            }
+
+            // A column sharing this one's pages in use, for a snapshot.
+            Column share() const
+            {
+                Column rv (info, shift);
+                auto used = (count + mask) >> shift;
+
+                rv.count = count;
+                rv.headers.assign(begin(headers), begin(headers) + used);
+                rv.pages.assign(begin(pages), begin(pages) + used);
+                fill_n(begin(owned), used, false);
+
+                for (auto page : rv.headers)
+                    ++page->refs;
+
+                return rv;
+            }
+
+            /* Makes this column share the pages of a snapshot's column.
+             * Rows of pages that differ are stamped with version v.
+             */
+            void restore(Column const& snap, Version v)
+            {
+                auto const& src = snap.headers;
+                auto common = min(headers.size(), src.size());
+
+                for (size_t i=0; i<common; ++i)
+                {
+                    if (headers[i] == src[i])
+                        continue;
+
+                    releasePage(headers[i], rowsIn(i, count));
+                    headers[i] = src[i];
+                    pages[i] = src[i]->data;
+                    owned[i] = false;
+                    ++src[i]->refs;
+                    stampPage(i, rowsIn(i, snap.count), v);
+                }
+
+                while (headers.size() > src.size())
+                    popPage();
+
+                for (size_t i=headers.size(); i<src.size(); ++i)
+                {
+                    ++src[i]->refs;
+                    appendPage(src[i], false);
+                    stampPage(i, rowsIn(i, snap.count), v);
+                }
+
+                count = snap.count;
+            }
+
+        private:
+
+            void appendPage(PageHeader* page, bool own)
+            {
+                try
+                {
+                    reserveMore(headers, 1);
+                    reserveMore(pages, 1);
+                    reserveMore(owned, 1);
+                    reserveMore(versions, mask + 1);
+                    reserveMore(pageVersions, 1);
+                }
+                catch (...)
+                {
+                    releasePage(page, 0);
+                    throw;
+                }
+
+                headers.push_back(page);
+                pages.push_back(page->data);
+                owned.push_back(own);
+                versions.resize(versions.size() + mask + 1, 0);
+                pageVersions.push_back(0);
+            }
+
+            void stampPage(size_t page, size_t rows, Version v)
+            {
+                fill_n(begin(versions) + (page << shift), rows, v);
+                pageVersions[page] = v;
+            }
+    };
+
+// Queries
+
+    // Not
+
+        template <typename... Ts>
+        struct Not
+        {};
+
+        // IsNot
+
+            template <typename T>
+            struct IsNot : false_type
+            {};
+
+            template <typename... Ts>
+            struct IsNot<Not<Ts...>> : true_type
+            {};
+
+        // FlattenNots
+
+            template <typename T>
+            struct FlattenNots;
+
+            template <typename T>
+            using FlattenNots_t = typename FlattenNots<T>::type;
+
+            template <typename... Ts, typename... Us>
+            struct FlattenNots<TypeList<Not<Ts...>, Us...>>
+            {
+                using type = TypeListCat_t<TypeList<Ts...>,
+                    FlattenNots_t<TypeList<Us...>>>;
+            };
+
+            template <>
+            struct FlattenNots<TypeList<>>
+            {
+                using type = TypeList<>;
+            };
+
+    // Changed
+
+        /* Matches Entities whose Ts were added or written since the previous
+         * run of the same query.
+         *
+         * "The same query" means the same list of properties: the last-seen
+         * version is kept per query type, not per caller. Two systems that
+         * issue an identical Changed query share it, so whichever runs
+         * first consumes the changes and the other sees none. Give each
+         * caller its own Tracker<Key> to keep them apart.
+         */
+        template <typename... Ts>
+        struct Changed
+        {};
+
+    // Tracker
+
+        /* Gives a query its own change-tracking state, keyed by the type Key.
+         * It matches everything and adds no component element; it only
+         * makes the query distinct from the same query with another Key.
+         */
+        template <typename Key>
+        struct Tracker
+        {};
+
+        // IsChanged
+
+            template <typename T>
+            struct IsChanged : false_type
+            {};
+
+            template <typename... Ts>
+            struct IsChanged<Changed<Ts...>> : true_type
+            {};
+
+        // FlattenChanged
+
+            template <typename T>
+            struct FlattenChanged;
+
+            template <typename T>
+            using FlattenChanged_t = typename FlattenChanged<T>::type;
+
+            template <typename... Ts, typename... Us>
+            struct FlattenChanged<TypeList<Changed<Ts...>, Us...>>
+            {
+                using type = TypeListCat_t<TypeList<Ts...>,
+                    FlattenChanged_t<TypeList<Us...>>>;
+            };
+
+            template <>
+            struct FlattenChanged<TypeList<>>
+            {
+                using type = TypeList<>;
+            };
+
+    // IsPositive
+
+        template <typename T>
+        struct IsPositive : true_type
+        {};
+
+        template <typename... Ts>
+        struct IsPositive<Not<Ts...>> : false_type
+        {};
+
+        template <typename... Ts>
+        struct IsPositive<Changed<Ts...>> : false_type
+        {};
+
+        template <typename Key>
+        struct IsPositive<Tracker<Key>> : false_type
+        {};
+
+    // QueryTraits
+
+        template <typename DB, typename... Ts>
+        struct QueryTraits
+        {
+            using types = TypeList<Ts...>;
+            using components = TypeListFilter_t<types, IsPositive>;
+
+            using EntID = typename DB::EntID;
+            using ComID = typename DB::ComID;
+
+            template <typename T>
+            using ComInfo = typename DB::template ComInfo<T>;
+
+            using component_dats = TypeListImbue_t<components, ComInfo>;
+
+            using result_item = TypeListCat_t<TypeList<EntID>,component_dats>;
+            using result_element = TypeListTuple_t<result_item>;
+
+            using result = vector<result_element>;
+
+            using nots = FlattenNots_t<TypeListFilter_t<types, IsNot>>;
+
+            using changed =
+                FlattenChanged_t<TypeListFilter_t<types, IsChanged>>;
+        };
+
+        // QueryResult_t
+
+            template <typename DB, typename... Ts>
+            using QueryResult_t = typename QueryTraits<DB, Ts...>::result;
+
+/*! Morton code
+ *
+ * Interleaves the bits of two coordinates, so that sorting by the result
+ * walks a Z-order curve and keeps nearby points close together.
+ *
+ * @param x Horizontal coordinate.
+ * @param y Vertical coordinate.
+ * @return Z-order index of (x, y).
+ */
+inline uint64_t mortonCode(uint32_t x, uint32_t y)
+{
+    auto spread = [](uint64_t v)
+    {
+        v = (v | (v << 16)) & 0x0000FFFF0000FFFFull;
+        v = (v | (v << 8))  & 0x00FF00FF00FF00FFull;
+        v = (v | (v << 4))  & 0x0F0F0F0F0F0F0F0Full;
+        v = (v | (v << 2))  & 0x3333333333333333ull;
+        v = (v | (v << 1))  & 0x5555555555555555ull;
+        return v;
+    };
+
+    return spread(x) | (spread(y) << 1);
+}
+
+/*! Database
+ *
+ * An Entity component Database. Components live in typed column storage;
+ * the given allocator is only used, one pool per component type, for
+ * components that are displaced out of the Database.
+ *
+ * Empty component types are tags. A tag is only recorded as membership in
+ * a per-type set of Entities; it is never constructed, stored or boxed, and
+ * adding or removing one does not move the Entity's other components.
+ *
+ * Types listed in ComponentList have constant GUIDs, so looking them up
+ * costs nothing at runtime and their IDs do not depend on the order in
+ * which they are first used. Other types still work, and are numbered after
+ * the listed ones on first use.
+ *
+ * Entities are grouped into archetypes by their exact set of component types.
+ * Each archetype stores its components as contiguous per-type columns, split
+ * into fixed-size chunks, so a query walks dense arrays instead of chasing one
+ * heap node per component.
+ *
+ * Every column row carries the version of its last write, and every chunk the
+ * newest version among its rows, so a `Changed<...>` query skips unchanged
+ * chunks outright and only tests rows in chunks that were written.
+ *
+ * The Database takes a lock only to create a query's cache, on that query's
+ * first use, so any thread may use a query first. Otherwise, these may run
+ * at the same time on different threads:
+ *
+ * - Reading components of any type that no thread is writing.
+ * - Writing components of different types, as Scheduler systems that do
+ *   not conflict do. Pages shared with a Snapshot or FrontBuffer are
+ *   claimed through atomic reference counts.
+ * - par_for_each(), which gives each chunk to one thread.
+ * - Using an unlisted component type for the first time.
+ * - Reading a FrontBuffer, while the Database goes on.
+ *
+ * Everything else must happen at a sync point, while no other thread uses
+ * the Database. That includes adding or removing Entities or components,
+ * flushing a CommandBuffer, snapshot(), restore(), publish(), save(),
+ * load(), compact(), reorder() and index(). Two threads must not run the
+ * same `Changed<...>` query at once.
+ *
+ * @tparam AllocatorT Component allocator.
+ * @tparam ComponentList Components<...> list of known component types.
+ */
+template <template <typename> class AllocatorT = allocator,
+          typename ComponentList = Components<>>
+class Database
+{
+    public:
+
+        // forward declarations
+
+            class EntID;
+            class ComID;
+
+            template <typename Com>
+            class ComInfo;
+
+    private:
+
+    using size_type = size_t;
+    using index_type = uint32_t;
+
+    class Archetype;
+
+    static constexpr index_type NO_INDEX = numeric_limits<index_type>::max();
+
+    /* EntityData
+     *
+     * A slot in the entity table. While the slot is free, archetype is null
+     * and row links to the next free slot.
+     */
+    struct EntityData
+    {
+        Archetype* archetype;
+        index_type row;
+        index_type generation;
+    };
+
+    /* TagSet
+     *
+     * The Entities that have one tag component, as a sparse set of slot
+     * indices. Adding, removing and testing a tag are O(1), and the members
+     * can be visited densely.
+     */
+    struct TagSet
+    {
+        vector<index_type> members;
+        vector<index_type> positions;
+
+        bool has(index_type slot) const
+        {
+            return (slot < positions.size() && positions[slot] != NO_INDEX);
+        }
+
+        void insert(index_type slot)
+        {
+            if (has(slot))
+                return;
+
+            if (positions.size() <= slot)
+                positions.resize(slot + 1, NO_INDEX);
+
+            positions[slot] = members.size();
+            members.push_back(slot);
+        }
+
+        void erase(index_type slot)
+        {
+            if (!has(slot))
+                return;
+
+            auto pos = positions[slot];
+            members[pos] = members.back();
+            positions[members[pos]] = pos;
+            members.pop_back();
+            positions[slot] = NO_INDEX;
+        }
+
+        void clear()
+        {
+            for (auto slot : members)
+                positions[slot] = NO_INDEX;
+            members.clear();
+        }
+    };
+
+    /* EntityTable
+     *
+     * Dense table of entity slots, recycled through an intrusive free list.
+     * Held by pointer so that EntIDs survive moving the Database.
+     *
+     * Tag components live here, one TagSet per tag GUID, instead of in
+     * archetypes.
+     */
+    struct EntityTable
+    {
+        vector<EntityData> slots;
+        index_type freeHead = NO_INDEX;
+        vector<TagSet> tags;
+
+        // Number of Entities with each non-tag component, by GUID.
+        vector<size_type> population;
+
+        // Stamp for component writes. Advanced by change-tracking queries.
+        mutable atomic<Version> version {1};
+
+        // Guards the Database's list of query caches, since systems running
+        // at once may each make a cache on first use.
+        mutable mutex cacheMutex;
+
+        bool hasTag(GUID guid, index_type slot) const
+        {
+            return (size_type(guid) < tags.size() && tags[guid].has(slot));
+        }
+
+        TagSet& tagSet(GUID guid)
+        {
+            if (tags.size() <= size_type(guid))
+                tags.resize(guid + 1);
+            return tags[guid];
+        }
+    };
+
+    // Empty component types are stored as tags.
+    template <typename T>
+    using IsTag = is_empty<typename remove_cv<T>::type>;
+
+    // Stands in for the value of a tag; tags have no state to store.
+    template <typename T>
+    static T* tagInstance()
+    {
+        static typename aligned_storage<sizeof(T), alignof(T)>::type storage;
+        return reinterpret_cast<T*>(&storage);
+    }
+
+    // Members of a tag that has never been used.
+    static TagSet const& emptyTagSet()
+    {
+        static TagSet const rv;
+        return rv;
+    }
+
+    /* Address of a row's element, or of the stand-in for a tag.
+     * Mutable access owns the row's page, so the rest of the row's chunk may
+     * be written through the result too.
+     */
+    template <typename T>
+    static void* rowBase(Column const* col, size_type row)
+    {
+        using U = typename remove_cv<T>::type;
+
+        if (IsTag<T>::value)
+            return tagInstance<U>();
+
+        return (is_const<T>::value ? col->at(row) : col->edit(row));
+    }
+
+    // Element at offset from base, where base came from rowBase().
+    template <typename T>
+    static T& element(void* base, size_type offset)
+    {
+        return static_cast<T*>(base)[IsTag<T>::value ? 0 : offset];
+    }
+
+    template <typename T>
+    static T* rowElement(Column const* col, size_type row)
+    {
+        return &element<T>(rowBase<T>(col, row), 0);
+    }
+
+    // Approximate number of bytes of component data per archetype chunk.
+    static constexpr size_type CHUNK_BYTES = 16U * 1024U;
+    static constexpr size_type MAX_CHUNK_SHIFT = 10U;
+
+    /* Archetype
+     *
+     * All Entities that have exactly the same set of components.
+     * Row `i` of every column belongs to the Entity in slot `entities[i]`.
+     */
+    class Archetype
+    {
+        friend class Database;
+
+        EntityTable* table;
+        size_type id;
+        vector<GUID> signature;
+        ComponentMask mask;
+        vector<Column> columns;
+        vector<index_type> entities;
+
+        // Sparse map from GUID to the dense index of its column.
+        vector<index_type> columnIndex;
+        size_type shift = 0;
+        size_type chunks = 0;
+
+        // Cached transitions to the archetypes one component away.
+        vector<pair<GUID,Archetype*>> addEdges;
+        vector<pair<GUID,Archetype*>> removeEdges;
+
+        public:
+
+            Archetype(EntityTable* t, size_type i,
+                      vector<TypeInfo const*> const& infos)
+                : table(t)
+                , id(i)
+            {
+                size_type rowBytes = 0;
+
+                for (auto info : infos)
+                    rowBytes += info->size;
+
+                while (shift < MAX_CHUNK_SHIFT
+                   && (size_type(2) << shift) * rowBytes <= CHUNK_BYTES)
+                {
+                    ++shift;
+                }
+
+                signature.reserve(infos.size());
+                columns.reserve(infos.size());
+
+                for (auto info : infos)
+                {
+                    signature.push_back(info->guid);
+                    addToMask(mask, info->guid);
+                    columns.emplace_back(info, shift);
+                }
+
+                if (!signature.empty())
+                {
+                    columnIndex.assign(signature.back() + 1, NO_INDEX);
+
+                    if (table->population.size() <= columnIndex.size())
+                        table->population.resize(columnIndex.size(), 0);
+                }
+
+                for (size_type i=0; i<signature.size(); ++i)
+                    columnIndex[signature[i]] = i;
+            }
+
+            Archetype(Archetype const&) = delete;
+            Archetype& operator=(Archetype const&) = delete;
+
+            size_type size() const
+            {
+                return entities.size();
+            }
+
+            EntID makeEntID(size_type row) const
+            {
+                EntID rv;
+                rv.table = table;
+                rv.index = entities[row];
+                rv.generation = table->slots[rv.index].generation;
+                return rv;
+            }
+
+            Column* findColumn(GUID guid)
+            {
+                if (size_type(guid) < columnIndex.size())
+                {
+                    auto i = columnIndex[guid];
+                    if (i != NO_INDEX)
+                        return &columns[i];
+                }
+
+                return nullptr;
+            }
+
+            Column const* findColumn(GUID guid) const
+            {
+                return const_cast<Archetype*>(this)->findColumn(guid);
+            }
+
+            bool has(GUID guid) const
+            {
+                return (size_type(guid) < MAX_COMPONENT_TYPES && mask[guid]);
+            }
+
+            /* Appends an uninitialized row owned by ent.
+             * The caller must construct every column of the new row.
+             */
+            size_type pushRow(index_type ent)
+            {
+                if (size() == (chunks << shift))
+                {
+                    for (auto& col : columns)
+                        col.pushPage();
+                    ++chunks;
+                }
+
+                entities.push_back(ent);
+
+                auto row = size() - 1;
+
+                for (auto& col : columns)
+                {
+                    col.grow();
+                    col.touch(row, table->version);
+                    ++table->population[col.getGUID()];
+                }
+
+                return row;
+            }
+
+            // Allocates chunks until the archetype can hold rows rows.
+            void reserve(size_type rows)
+            {
+                auto needed = (rows + (size_type(1) << shift) - 1) >> shift;
+
+                if (needed <= chunks)
+                    return;
+
+                entities.reserve(rows);
+
+                for (auto& col : columns)
+                    col.reservePages(needed);
+
+                while (chunks < needed)
+                {
+                    for (auto& col : columns)
+                        col.pushPage();
+                    ++chunks;
+                }
+            }
+
+            /* Removes the last row without destroying it.
+             * Only used to roll back a pushRow().
+             */
+            void popRow()
+            {
+                unpopulate();
+                entities.pop_back();
+                trimChunks();
+            }
+
+            void destroyRow(size_type row)
+            {
+                for (auto& col : columns)
+                {
+                    col.own(row);
+                    col.getInfo().destroy(col.at(row));
+                }
+            }
+
+            /* Removes an already destroyed row by relocating the last row
+             * into its place.
+             */
+            void vacateRow(size_type row)
+            {
+                auto last = size() - 1;
+
+                if (row != last)
+                {
+                    for (auto& col : columns)
+                    {
+                        col.own(last);
+                        col.getInfo().relocate(col.at(row), col.at(last));
+                        col.touch(row, col.getVersion(last));
+                    }
+
+                    entities[row] = entities[last];
+                    table->slots[entities[row]].row = row;
+                }
+
+                unpopulate();
+                entities.pop_back();
+                trimChunks();
+            }
+
+            /* Exchanges two rows, along with their version stamps.
+             * scratch must hold the largest component of the archetype.
+             */
+            void swapRows(size_type a, size_type b, void* scratch)
+            {
+                for (auto& col : columns)
+                {
+                    auto const& info = col.getInfo();
+                    auto va = col.getVersion(a);
+
+                    col.own(a);
+                    col.own(b);
+
+                    info.relocate(scratch, col.at(a));
+                    info.relocate(col.at(a), col.at(b));
+                    info.relocate(col.at(b), scratch);
+
+                    col.touch(a, col.getVersion(b));
+                    col.touch(b, va);
+                }
+
+                swap(entities[a], entities[b]);
+                table->slots[entities[a]].row = a;
+                table->slots[entities[b]].row = b;
+            }
+
+            // Rows and columns as kept by a Snapshot.
+            struct State
+            {
+                vector<index_type> entities;
+                vector<Column> columns;
+            };
+
+            State share() const
+            {
+                State rv;
+                rv.entities = entities;
+                rv.columns.reserve(columns.size());
+
+                for (auto const& col : columns)
+                    rv.columns.push_back(col.share());
+
+                return rv;
+            }
+
+            // Frees every unused chunk, and spare capacity.
+            void compact()
+            {
+                trimChunks(0);
+                entities.shrink_to_fit();
+
+                for (auto& col : columns)
+                    col.shrinkToFit();
+            }
+
+            /* Returns to a shared state, or to empty if state has no columns.
+             * Rows of pages that differ are stamped with version v.
+             */
+            void restore(State const& state, Version v)
+            {
+                for (size_type i=0; i<columns.size(); ++i)
+                {
+                    if (i < state.columns.size())
+                        columns[i].restore(state.columns[i], v);
+                    else
+                        columns[i].restore(
+                            Column(&columns[i].getInfo(), shift), v);
+                }
+
+                entities = state.entities;
+                chunks = (size() + (size_type(1) << shift) - 1) >> shift;
+            }
+
+        private:
+
+            void unpopulate()
+            {
+                for (auto& col : columns)
+                {
+                    col.shrink();
+                    --table->population[col.getGUID()];
+                }
+            }
+
+            // Frees trailing chunks, keeping spare to avoid thrashing.
+            void trimChunks(size_type spare = 1)
+            {
+                auto used = (size() + (size_type(1) << shift) - 1) >> shift;
+
+                while (chunks > used + spare)
+                {
+                    for (auto& col : columns)
+                        col.popPage();
+                    --chunks;
+                }
+            }
+    };
+
+    /* QueryCacheBase
+     *
+     * A persistent query. It is shown every new archetype, so its list of
+     * matching archetypes is kept up to date without rescanning.
+     */
+    class QueryCacheBase
+    {
+        public:
+
+            virtual ~QueryCacheBase() = default;
+
+            virtual void inspect(Archetype const& arch) = 0;
+    };
+
+    unique_ptr<EntityTable> entities;
+    vector<unique_ptr<Archetype>> archetypes;
+    unordered_map<ComponentMask, Archetype*> archetypeIndex;
+    mutable vector<unique_ptr<QueryCacheBase>> queryCaches;
+    Archetype* root;
+
+    // Observers
+
+        using Observer = function<void(EntID, void*)>;
+
+        struct ObserverSet
+        {
+            vector<Observer> added;
+            vector<Observer> removed;
+            vector<Observer> changed;
+        };
+
+        using ObserverList = vector<Observer> ObserverSet::*;
+
+        // Observers by GUID.
+        vector<ObserverSet> observers;
+
+    // Reordering
+
+        // Progress of the incremental reorder() pass for one component type.
+        struct ReorderState
+        {
+            size_type match = 0;
+            size_type row = 0;
+            bool shifted = false;
+        };
+
+        // Reorder passes by GUID.
+        vector<ReorderState> reorders;
+
+    // Secondary indexes
+
+        struct IndexBase
+        {
+            virtual ~IndexBase() = default;
+
+            // Drops Entities that left without notifying observers.
+            virtual void prune(Database const& db) = 0;
+        };
+
+        // Indexes by index ID.
+        vector<unique_ptr<IndexBase>> indexes;
+
+    // Save files
+
+        struct Serializer
+        {
+            function<void(Writer&, void const*)> save;
+            function<void(Reader&, void*)> load;
+        };
+
+        // Custom serializers by GUID.
+        vector<Serializer> serializers;
+
+        /* A save file is a SaveHeader, then one SavedSlot per entity slot,
+         * the members of each non-empty tag, and each non-empty archetype.
+         * Each section starts aligned for a component page.
+         *
+         * An archetype is its column count, chunk shift, row count, column
+         * GUIDs and entity slots, then a SavedColumn and the data of each
+         * column. RAW columns are whole pages, each padded to that alignment,
+         * ready to be adopted in place. CUSTOM columns are a stream
+         * written by the type's Serializer.
+         */
+        struct SaveHeader
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t byteOrder;
+            uint32_t alignment;
+            uint32_t freeHead;
+            uint64_t slots;
+            uint32_t tags;
+            uint32_t archetypes;
+        };
+
+        struct SavedSlot
+        {
+            uint32_t archetype;
+            uint32_t row;
+            uint32_t generation;
+        };
+
+        enum class Encoding : uint32_t
+        {
+            RAW,
+            CUSTOM
+        };
+
+        struct SavedColumn
+        {
+            uint32_t guid;
+            uint32_t size;
+            Encoding encoding;
+            uint32_t pages;
+        };
+
+    // Component IDs
+
+        template <typename T>
+        using ListIndex = ComponentIndex<remove_cv_t<T>, ComponentList>;
+
+        template <typename T>
+        using IsListed = integral_constant<bool, (ListIndex<T>::value >= 0)>;
+
+        template <typename... Ts>
+        static constexpr GUID countListed(Components<Ts...>)
+        {
+            return sizeof...(Ts);
+        }
+
+        // Unlisted types may be first used on any thread.
+        static GUID nextGUID()
+        {
+            static atomic<GUID> next {countListed(ComponentList{})};
+            return next++;
+        }
+
+        template <typename T>
+        static GUID getUnlistedGUID()
+        {
+            static GUID guid = nextGUID();
+            return guid;
+        }
+
+        template <typename T>
+        static constexpr auto getGUID()
+            -> enable_if_t<IsListed<T>::value, GUID>
+        {
+            return ListIndex<T>::value;
+        }
+
+        template <typename T>
+        static auto getGUID()
+            -> enable_if_t<!IsListed<T>::value, GUID>
+        {
+            return getUnlistedGUID<remove_cv_t<T>>();
+        }
+
+    // Type registry
+
+        /* Every registered TypeInfo, by GUID. Unlisted types may be
+         * registered on any thread, even inside par_for_each(), so the table
+         * never moves and its entries are atomic.
+         */
+        struct TypeRegistry
+        {
+            array<atomic<TypeInfo const*>, MAX_COMPONENT_TYPES> infos;
+
+            // One past the highest registered GUID.
+            atomic<size_type> size;
+        };
+
+        static TypeRegistry& typeRegistry()
+        {
+            static TypeRegistry registry {};
+            return registry;
+        }
+
+        // The TypeInfo registered for guid, or null.
+        static TypeInfo const* findTypeInfo(GUID guid)
+        {
+            if (size_type(guid) >= MAX_COMPONENT_TYPES)
+                return nullptr;
+
+            return typeRegistry().infos[guid];
+        }
+
+        static size_type registeredTypes()
+        {
+            return typeRegistry().size;
+        }
+
+        // Empty components are never handed to AllocatorT.
+        template <typename T>
+        using BoxAllocator = typename conditional<is_empty<T>::value,
+            allocator<T>, AllocatorT<T>>::type;
+
+        template <typename T>
+        struct TypeOps
+        {
+            static void relocate(void* dst, void* src)
+            {
+                T& t = *static_cast<T*>(src);
+                ::new (dst) T(move(t));
+                t.~T();
+            }
+
+            static void destroy(void* ptr)
+            {
+                static_cast<T*>(ptr)->~T();
+            }
+
+            static void* box(void* src)
+            {
+                BoxAllocator<T> alloc;
+                T* ptr = alloc.allocate(1);
+
+                try
+                {
+                    ::new (ptr) T(move(*static_cast<T*>(src)));
+                }
+                catch (...)
+                {
+                    alloc.deallocate(ptr, 1);
+                    throw;
+                }
+
+                return ptr;
+            }
+
+            static void unbox(void* dst, void* box)
+            {
+                ::new (dst) T(move(*static_cast<T*>(box)));
+            }
+
+            static void assign(void* dst, void* box)
+            {
+                *static_cast<T*>(dst) = move(*static_cast<T*>(box));
+            }
+
+            static void freeBox(void* box)
+            {
+                BoxAllocator<T> alloc;
+                auto ptr = static_cast<T*>(box);
+                ptr->~T();
+                alloc.deallocate(ptr, 1);
+            }
+
+            static void copy(void* dst, void const* src)
+            {
+                ::new (dst) T(*static_cast<T const*>(src));
+            }
+
+            using CopyFn = void (*)(void*, void const*);
+
+            static constexpr CopyFn getCopy(true_type)
+            {
+                return &copy;
+            }
+
+            static constexpr CopyFn getCopy(false_type)
+            {
+                return nullptr;
+            }
+
+            // Only allocators with a trim() member can release memory.
+            template <typename A>
+            static auto trimAllocator(A& alloc, int)
+                -> decltype(size_t(alloc.trim()))
+            {
+                return alloc.trim();
+            }
+
+            template <typename A>
+            static size_t trimAllocator(A&, long)
+            {
+                return 0;
+            }
+
+            static size_t trimBoxes()
+            {
+                BoxAllocator<T> alloc;
+                return trimAllocator(alloc, 0);
+            }
+
+            static constexpr TypeInfo makeInfo(GUID guid)
+            {
+                static_assert(alignof(T) <= alignof(max_align_t),
+                    "Ginseng: Over-aligned components are not supported.");
+
+                return {
+                      guid
+                    , sizeof(T)
+                    , is_empty<T>::value
+                    , is_trivially_copyable<T>::value
+                    , &relocate
+                    , &destroy
+                    , &box
+                    , &unbox
+                    , &assign
+                    , &freeBox
+                    , getCopy(is_copy_constructible<T>{})
+                    , &trimBoxes
+                };
+            }
+
+            static TypeInfo const* registerType()
+            {
+                if (size_t(getGUID<T>()) >= MAX_COMPONENT_TYPES)
+                    throw length_error("Ginseng: Too many component types!");
+
+                static TypeInfo const info = makeInfo(getGUID<T>());
+
+                registerInfo(&info);
+
+                return &info;
+            }
+        };
+
+        // Constant-initialized TypeInfo for listed types.
+        template <typename T>
+        struct ListedTypeInfo
+        {
+            static constexpr TypeInfo value =
+                TypeOps<T>::makeInfo(ListIndex<T>::value);
+        };
+
+        // GUIDs handed out by getGUID() to types never registered are not
+        // tags, nor anything else.
+        static bool isTag(GUID guid)
+        {
+            auto info = findTypeInfo(guid);
+            return (info && info->tag);
+        }
+
+        static void registerInfo(TypeInfo const* info)
+        {
+            auto& registry = typeRegistry();
+            auto guid = size_type(info->guid);
+            auto size = registry.size.load();
+
+            registry.infos[guid] = info;
+
+            while (size <= guid
+                && !registry.size.compare_exchange_weak(size, guid + 1))
+            {}
+        }
+
+        template <typename... Ts>
+        static void registerListed(Components<Ts...>)
+        {
+            static_assert(sizeof...(Ts) <= MAX_COMPONENT_TYPES,
+                "Ginseng: Too many component types!");
+
+            TypeInfo const* infos[] = {nullptr, &ListedTypeInfo<Ts>::value...};
+
+            for (auto info : infos)
+                if (info)
+                    registerInfo(info);
+        }
+
+        template <typename T>
+        static auto getTypeInfo()
+            -> enable_if_t<IsListed<T>::value, TypeInfo const&>
+        {
+            return ListedTypeInfo<T>::value;
+        }
+
+        template <typename T>
+        static auto getTypeInfo()
+            -> enable_if_t<!IsListed<T>::value, TypeInfo const&>
+        {
+            static TypeInfo const* info = TypeOps<T>::registerType();
+            return *info;
+        }
+
+    // Archetype graph
+
+        Archetype& getArchetype(vector<GUID> const& sig)
+        {
+            ComponentMask mask;
+
+            for (auto guid : sig)
+                addToMask(mask, guid);
+
+            auto iter = archetypeIndex.find(mask);
+
+            if (iter != end(archetypeIndex))
+                return *iter->second;
+
+            vector<TypeInfo const*> infos;
+            infos.reserve(sig.size());
+
+            for (auto guid : sig)
+                infos.push_back(findTypeInfo(guid));
+
+            archetypes.emplace_back(make_unique<Archetype>(
+                entities.get(), archetypes.size(), infos));
+            auto ptr = archetypes.back().get();
+            archetypeIndex.emplace(mask, ptr);
+
+            for (auto const& cache : queryCaches)
+                if (cache)
+                    cache->inspect(*ptr);
+
+            return *ptr;
+        }
+
+        static Archetype* findEdge(vector<pair<GUID,Archetype*>> const& edges,
+                                   GUID guid)
+        {
+            for (auto const& edge : edges)
+                if (edge.first == guid)
+                    return edge.second;
+            return nullptr;
+        }
+
+        template <typename... Ts>
+        Archetype& getArchetypeOf()
+        {
+            array<GUID, sizeof...(Ts)> guids = {{getTypeInfo<Ts>().guid...}};
+            array<bool, sizeof...(Ts)> tags = {{IsTag<Ts>::value...}};
+            vector<GUID> sig;
+
+            for (size_type i=0; i<guids.size(); ++i)
+                if (!tags[i])
+                    sig.push_back(guids[i]);
+
+            sort(begin(sig), end(sig));
+
+            if (adjacent_find(begin(sig), end(sig)) != end(sig))
+                throw invalid_argument("Ginseng: Duplicate component type!");
+
+            return getArchetype(sig);
+        }
+
+        Archetype& getArchetypeWith(Archetype& arch, GUID guid)
+        {
+            if (auto ptr = findEdge(arch.addEdges, guid))
+                return *ptr;
+
+            auto sig = arch.signature;
+            sig.insert(upper_bound(begin(sig), end(sig), guid), guid);
+
+            auto& rv = getArchetype(sig);
+            arch.addEdges.emplace_back(guid, &rv);
+            rv.removeEdges.emplace_back(guid, &arch);
+
+            return rv;
+        }
+
+        Archetype& getArchetypeWithout(Archetype& arch, GUID guid)
+        {
+            if (auto ptr = findEdge(arch.removeEdges, guid))
+                return *ptr;
+
+            auto sig = arch.signature;
+            sig.erase(lower_bound(begin(sig), end(sig), guid));
+
+            auto& rv = getArchetype(sig);
+            arch.removeEdges.emplace_back(guid, &rv);
+            rv.addEdges.emplace_back(guid, &arch);
+
+            return rv;
+        }
+
+        /* Moves an Entity's components into an already pushed row of dst.
+         * Components that dst does not have are destroyed, and columns of dst
+         * that the source lacks are left for the caller to construct.
+         */
+        void relocate(EntityData& ent, Archetype& dst, size_type dstRow)
+        {
+            auto& src = *ent.archetype;
+            auto srcRow = ent.row;
+
+            size_type j = 0;
+
+            for (auto& col : src.columns)
+            {
+                auto guid = col.getGUID();
+
+                while (j < dst.columns.size()
+                    && dst.columns[j].getGUID() < guid)
+                {
+                    ++j;
+                }
+
+                if (j < dst.columns.size() && dst.columns[j].getGUID() == guid)
+                {
+                    auto& dstCol = dst.columns[j];
+                    dstCol.getInfo().relocate(dstCol.at(dstRow),
+                                              col.edit(srcRow));
+                    dstCol.touch(dstRow, col.getVersion(srcRow));
+                }
+                else
+                {
+                    col.getInfo().destroy(col.edit(srcRow));
+                }
+            }
+
+            src.vacateRow(srcRow);
+
+            ent.archetype = &dst;
+            ent.row = dstRow;
+        }
+
+    // Entity table
+
+        EntityData& getData(EntID eid)
+        {
+            return entities->slots[eid.index];
+        }
+
+        EntID makeEntID(index_type index) const
+        {
+            EntID rv;
+            rv.table = entities.get();
+            rv.index = index;
+            rv.generation = entities->slots[index].generation;
+            return rv;
+        }
+
+        /* Takes a slot from the free list, or appends a new one, and places
+         * it in a new uninitialized row of arch.
+         */
+        index_type allocEntity(Archetype& arch)
+        {
+            auto& table = *entities;
+            index_type index;
+
+            if (table.freeHead != NO_INDEX)
+            {
+                index = table.freeHead;
+                table.freeHead = table.slots[index].row;
+            }
+            else
+            {
+                if (table.slots.size() == NO_INDEX)
+                    throw length_error("Ginseng: Too many entities!");
+
+                index = table.slots.size();
+                table.slots.push_back(EntityData{nullptr, NO_INDEX, 0});
+            }
+
+            auto& slot = table.slots[index];
+
+            try
+            {
+                slot.row = arch.pushRow(index);
+            }
+            catch (...)
+            {
+                slot.row = table.freeHead;
+                table.freeHead = index;
+                throw;
+            }
+
+            slot.archetype = &arch;
+
+            return index;
+        }
+
+        /* Returns a slot to the free list, drops its tags and bumps its
+         * generation. A slot whose generation would wrap around is retired
+         * instead.
+         */
+        void freeEntity(index_type index)
+        {
+            auto& table = *entities;
+            auto& slot = table.slots[index];
+
+            for (auto& set : table.tags)
+                set.erase(index);
+
+            slot.archetype = nullptr;
+
+            if (++slot.generation != 0)
+            {
+                slot.row = table.freeHead;
+                table.freeHead = index;
+            }
+        }
+
+        /* Called by restore() once the snapshot's slots are in place, with
+         * the slots they replaced. Free slots are given generations past any
+         * EntID handed out from newer, and slots only newer had are kept,
+         * free, so that no such EntID can match an Entity made later. Slots
+         * that run out of generations are retired.
+         */
+        void retireHandles(vector<EntityData> const& newer)
+        {
+            auto& table = *entities;
+            auto& slots = table.slots;
+            auto restored = slots.size();
+            auto next = table.freeHead;
+            auto tail = NO_INDEX;
+
+            slots.resize(max(restored, newer.size()),
+                         EntityData{nullptr, NO_INDEX, 0});
+            table.freeHead = NO_INDEX;
+
+            auto link = [&](index_type index)
+            {
+                (tail == NO_INDEX ? table.freeHead : slots[tail].row) = index;
+                slots[index].row = NO_INDEX;
+                tail = index;
+            };
+
+            auto relink = [&](index_type index)
+            {
+                if (index >= newer.size())
+                    return link(index);
+
+                auto const& old = newer[index];
+                index_type gen = old.generation + (old.archetype ? 1 : 0);
+
+                // A free slot of generation zero was retired.
+                if (gen == 0)
+                    return;
+
+                slots[index].generation = max(slots[index].generation, gen);
+                link(index);
+            };
+
+            while (next != NO_INDEX)
+            {
+                auto index = next;
+                next = slots[index].row;
+                relink(index);
+            }
+
+            for (auto i = restored; i < newer.size(); ++i)
+                relink(index_type(i));
+        }
+
+        static void checkCopyable(Archetype const& arch)
+        {
+            for (auto const& col : arch.columns)
+                if (!col.getInfo().copy)
+                    throw logic_error("Ginseng: Component is not copyable!");
+        }
+
+        /* Copy-constructs rows [first, last) of col from src, counting them
+         * in done. Trivially copyable elements are copied with memcpy,
+         * doubling the copied span within each page.
+         */
+        static void fillColumn(Column& col, size_type first, size_type last,
+                               void const* src, size_type& done)
+        {
+            auto const& info = col.getInfo();
+
+            if (!info.trivial)
+            {
+                for (auto row=first; row<last; ++row, ++done)
+                    info.copy(col.at(row), src);
+                return;
+            }
+
+            for (auto row=first; row<last;)
+            {
+                auto end = min(last, (row / col.pageRows() + 1)
+                    * col.pageRows());
+                auto base = static_cast<unsigned char*>(col.at(row));
+                auto rows = end - row;
+
+                memcpy(base, src, info.size);
+
+                for (size_type n=1; n<rows;)
+                {
+                    auto m = min(n, rows - n);
+                    memcpy(base + n * info.size, base, m * info.size);
+                    n += m;
+                }
+
+                row = end;
+            }
+
+            done = last - first;
+        }
+
+        /* Appends count Entities to arch, copy-constructing each element of
+         * column i from src(i). Columns are filled one at a time. Everything
+         * is rolled back if a copy throws.
+         *
+         * @return Row of the first new Entity.
+         */
+        template <typename Source>
+        size_type spawnRows(Archetype& arch, size_type count, Source&& src)
+        {
+            auto first = arch.size();
+            size_type c = 0;
+            size_type done = 0;
+
+            try
+            {
+                for (size_type i=0; i<count; ++i)
+                    allocEntity(arch);
+
+                for (; c<arch.columns.size(); ++c)
+                {
+                    done = 0;
+                    fillColumn(arch.columns[c], first, arch.size(), src(c),
+                               done);
+                }
+            }
+            catch (...)
+            {
+                for (size_type i=0; i<=c && i<arch.columns.size(); ++i)
+                {
+                    auto& col = arch.columns[i];
+                    auto last = (i < c ? arch.size() : first + done);
+
+                    for (auto row=first; row<last; ++row)
+                        col.getInfo().destroy(col.at(row));
+                }
+
+                while (arch.size() > first)
+                {
+                    auto index = arch.entities.back();
+                    arch.popRow();
+                    freeEntity(index);
+                }
+
+                throw;
+            }
+
+            return first;
+        }
+
+        // Address of a component, or null if the Entity does not have it.
+        void* findComponent(ComID cid)
+        {
+            auto const& ent = getData(cid.eid);
+
+            if (entities->hasTag(cid.guid, cid.eid.index))
+                return tagInstance<max_align_t>();
+
+            if (auto col = ent.archetype->findColumn(cid.guid))
+                return col->edit(ent.row);
+
+            return nullptr;
+        }
+
+        // Removes a component, without notifying.
+        void removeComponent(ComID cid)
+        {
+            auto& ent = getData(cid.eid);
+
+            if (entities->hasTag(cid.guid, cid.eid.index))
+            {
+                entities->tags[cid.guid].erase(cid.eid.index);
+                return;
+            }
+
+            if (!ent.archetype->has(cid.guid))
+                return;
+
+            auto& dst = getArchetypeWithout(*ent.archetype, cid.guid);
+            auto row = dst.pushRow(cid.eid.index);
+            relocate(ent, dst, row);
+        }
+
+        // Destroys an Entity's components and frees it, without notifying.
+        void destroyEntity(EntID eid)
+        {
+            auto& ent = getData(eid);
+            auto& arch = *ent.archetype;
+            auto row = ent.row;
+
+            arch.destroyRow(row);
+            arch.vacateRow(row);
+
+            freeEntity(eid.index);
+        }
+
+    // Observer helpers
+
+        template <typename T, typename F>
+        void addObserver(ObserverList list, F&& fn)
+        {
+            auto guid = getTypeInfo<T>().guid;
+
+            if (observers.size() <= size_type(guid))
+                observers.resize(guid + 1);
+
+            (observers[guid].*list).push_back(
+                [fn](EntID eid, void* ptr) mutable
+                {
+                    fn(eid, *static_cast<T*>(ptr));
+                });
+        }
+
+        void notify(ObserverList list, GUID guid, EntID eid, void* ptr)
+        {
+            if (size_type(guid) >= observers.size())
+                return;
+
+            for (auto& fn : observers[guid].*list)
+                fn(eid, ptr);
+        }
+
+        // Notifies list of every component of an Entity, tags included.
+        void notifyAll(ObserverList list, EntID eid)
+        {
+            if (observers.empty())
+                return;
+
+            auto const& ent = getData(eid);
+
+            for (auto& col : ent.archetype->columns)
+                notify(list, col.getGUID(), eid, col.edit(ent.row));
+
+            auto const& tags = entities->tags;
+            auto count = min(tags.size(), observers.size());
+
+            for (size_type guid=0; guid<count; ++guid)
+                if (tags[guid].has(eid.index))
+                    notify(list, guid, eid, tagInstance<max_align_t>());
+        }
+
+    public:
+
+        Database()
+            : entities(make_unique<EntityTable>())
+            , root(&getArchetype({}))
+        {
+            registerListed(ComponentList{});
+        }
+
+        Database(Database const&) = delete;
+        Database(Database &&) = default;
+        Database& operator=(Database const&) = delete;
+        Database& operator=(Database &&) = default;
+
+    // IDs
+
+        /*! Entity ID
+         *
+         * A handle to an Entity. Very lightweight and trivially copyable.
+         *
+         * An EntID is an index into the Database's entity table paired with
+         * the generation of that slot. Slots are recycled, but their
+         * generation changes each time, so a handle to an erased Entity can
+         * be detected with Database::isValid().
+         */
+        class EntID
+        {
+            friend class Database;
+
+            EntityTable const* table = nullptr;
+            index_type index = 0;
+            index_type generation = 0;
+
+            EntityData const& getData() const
+            {
+                return table->slots[index];
+            }
+
+            // Whether the Entity still exists, as Database::isValid().
+            bool alive() const
+            {
+                return (table
+                    && index < table->slots.size()
+                    && table->slots[index].generation == generation
+                    && table->slots[index].archetype);
+            }
+
+            public:
+
+                /*! Query the Entity for a component.
+                 *
+                 * Queries the Entity for the given component type.
+                 * If found, returns a valid ComInfo object for the requested
+                 * component.
+                 * Otherwise, returns an invalid ComInfo object. So does a
+                 * handle to an erased Entity, even if its slot has been
+                 * reused.
+                 *
+                 * Getting a mutable component marks it changed, like a
+                 * mutable query term. Request `const T` to only read it.
+                 *
+                 * @tparam T Explicit type of component.
+                 * @return ComInfo for the requested component.
+                 */
+                template <typename T>
+                ComInfo<T> get() const
+                {
+                    T* ptr = nullptr;
+                    ComID cid;
+
+                    GUID guid = getGUID<T>();
+
+                    cid.eid = *this;
+                    cid.guid = guid;
+
+                    if (!alive())
+                        return {ptr,cid};
+
+                    auto const& ent = getData();
+
+                    if (IsTag<T>::value)
+                    {
+                        if (table->hasTag(guid, index))
+                            ptr = tagInstance<T>();
+                    }
+                    else if (auto col = ent.archetype->findColumn(guid))
+                    {
+                        ptr = rowElement<T>(col, ent.row);
+                        touchRow<T>(col, ent.row, table->version);
+                    }
+
+                    return {ptr,cid};
+                }
+
+                /*! Query the Entity for multiple components.
+                 *
+                 * Returns a tuple containing results equivalent to multiple
+                 * calls to get().
+                 *
+                 * For example, if `eid.getComs<X,Y,Z>()` is called, it is
                  * equivalent to calling
                  * `std::make_tuple(get<X>(),get<Y>(),get<Z>())`.
                  *
-                 * @tparam Ts Explicit component types.
-                 * @return Tuple of results equivalent to get().
+                 * @tparam Ts Explicit component types.
+                 * @return Tuple of results equivalent to get().
+                 */
+                template <typename... Ts>
+                tuple<ComInfo<Ts>...> getComs() const
+                {
+                    return make_tuple(get<Ts>()...);
+                }
+
+                /*! Compares this EntID to another for equivalence.
+                 *
+                 * Returns true only if the two EntIDs are handles to the same
+                 * Entity.
+                 *
+                 * @param other The EntID to compare to this.
+                 * @return True if EntIDs are equivalent.
+                 */
+                bool operator==(EntID const& other) const
+                {
+                    return (index == other.index
+                        && generation == other.generation
+                        && table == other.table);
+                }
+
+                /*! Compares this EntID to another for ordering.
+                 *
+                 * Provides a strict weak ordering for EntIDs.
+                 *
+                 * @param other The EntID to compare to this.
+                 * @return True if this should be ordered before other.
+                 */
+                bool operator<(EntID const& other) const
+                {
+                    if (index != other.index)
+                        return (index < other.index);
+                    return (generation < other.generation);
+                }
+        };
+
+        /*! Component ID
+         *
+         * A handle to a type-erased component. Very lightweight.
+         *
+         * A ComID names a component by its Entity and type, so it remains
+         * valid while the Entity gains or loses other components.
+         */
+        class ComID
+        {
+            friend class Database;
+
+            EntID eid;
+            GUID guid = 0;
+
+            public:
+
+                /*! Access component data.
+                 *
+                 * Reverses type erasure on the component's data.
+                 * The specified type must match the component's real type,
+                 * otherwise behaviour is undefined.
+                 *
+                 * As with EntID::get(), a mutable cast marks the component
+                 * changed.
+                 *
+                 * @tparam Explicit component data type.
+                 * @return Reference to component data.
+                 */
+                template <typename T>
+                T& cast() const
+                {
+                    auto const& ent = eid.getData();
+                    auto col = ent.archetype->findColumn(guid);
+                    auto ptr = rowElement<T>(col, ent.row);
+                    touchRow<T>(col, ent.row, eid.table->version);
+                    return *ptr;
+                }
+
+                /*! Get parent's EntID.
+                 *
+                 * Returns a handle to the parent Entity.
+                 *
+                 * @return Handle to parent Entity.
+                 */
+                EntID const& getEID() const
+                {
+                    return eid;
+                }
+
+                /*! Compares this ComID to another for equivalence.
+                 *
+                 * Returns true only if the two ComIDs are handles to the same
+                 * Component.
+                 *
+                 * @param other The ComID to compare to this.
+                 * @return True if ComIDs are equivalent.
+                 */
+                bool operator==(ComID const& other) const
+                {
+                    return (eid == other.eid && guid == other.guid);
+                }
+
+                /*! Compares this ComID to another for ordering.
+                 *
+                 * Provides a strict weak ordering for ComIDs.
+                 *
+                 * @param other The ComID to compare to this.
+                 * @return True if this should be ordered before other.
+                 */
+                bool operator<(ComID const& other) const
+                {
+                    if (eid == other.eid)
+                        return (guid < other.guid);
+                    return (eid < other.eid);
+                }
+        };
+
+        /*! Component Info
+         *
+         * A handle to a component of known type.
+         * Provides direct access to the component,
+         * as well as its ComID.
+         *
+         * @tparam Com Component type.
+         */
+        template <typename Com>
+        class ComInfo
+        {
+            friend class Database;
+
+            mutable Com* ptr = nullptr;
+            ComID cid;
+
+            // Set by query(), whose ptr may be in a page shared with a
+            // Snapshot. The page is claimed, and the component marked
+            // changed, when data() is first called.
+            mutable bool pending = false;
+
+            ComInfo(Com* p, ComID i)
+                : ptr(p)
+                , cid(i)
+            {}
+
+            public:
+
+                using type = Com;
+
+                ComInfo() = default;
+
+                /*! Test for validity.
+                 *
+                 * True if this ComInfo points to a component.
+                 * False otherwise.
+                 *
+                 * @return True if valid.
+                 */
+                explicit operator bool() const
+                {
+                    return ptr;
+                }
+
+                /*! Get component.
+                 *
+                 * @warning
+                 * Behaviour is undefined if this ComInfo is invalid.
+                 *
+                 * @warning
+                 * The reference is invalidated by any change to the set of
+                 * components of any Entity that shares this Entity's
+                 * archetype.
+                 *
+                 * @return The component.
+                 */
+                Com& data() const
+                {
+                    if (pending)
+                    {
+                        ptr = &cid.template cast<Com>();
+                        pending = false;
+                    }
+
+                    return *ptr;
+                }
+
+                /*! Get component ID.
+                 *
+                 * @warning
+                 * Behaviour is undefined if this ComInfo is invalid.
+                 *
+                 * @return A ComID handle for this component.
+                 */
+                ComID const& id() const
+                {
+                    return cid;
+                }
+        };
+
+    // Entity functions
+
+        /*! Creates a new Entity.
+         *
+         * Creates a new Entity that has no components.
+         *
+         * @return EntID of the new Entity.
+         */
+        EntID makeEntity()
+        {
+            return makeEntID(allocEntity(*root));
+        }
+
+        /*! Creates many Entities at once.
+         *
+         * Creates count new Entities that each have a default-constructed
+         * component of every type in Ts, then calls func on each of them.
+         * Storage is allocated once up front, and the Entities are built
+         * directly in place without moving between archetypes.
+         *
+         * @tparam Ts Component types. Must be default-constructible.
+         * @param count Number of Entities to create.
+         * @param func Callable as `func(EntID, Ts&...)`, used to initialize
+         * the components of each new Entity.
+         */
+        template <typename... Ts, typename Func>
+        void createMany(size_type count, Func&& func)
+        {
+            auto& arch = getArchetypeOf<Ts...>();
+            array<Column*, sizeof...(Ts)> cols =
+                {{arch.findColumn(getGUID<Ts>())...}};
+            array<GUID, sizeof...(Ts)> guids = {{getGUID<Ts>()...}};
+            array<bool, sizeof...(Ts)> isTags = {{IsTag<Ts>::value...}};
+            vector<TagSet*> tags;
+
+            for (size_type i=0; i<guids.size(); ++i)
+                if (isTags[i])
+                    entities->tagSet(guids[i]);
+
+            for (size_type i=0; i<guids.size(); ++i)
+                if (isTags[i])
+                    tags.push_back(&entities->tagSet(guids[i]));
+
+            reserve(entities->slots.size() + count);
+            arch.reserve(arch.size() + count);
+
+            for (size_type i=0; i<count; ++i)
+            {
+                auto index = allocEntity(arch);
+                auto row = entities->slots[index].row;
+
+                try
+                {
+                    constructRow(cols.data(), row, TypeList<Ts...>{});
+                }
+                catch (...)
+                {
+                    arch.popRow();
+                    freeEntity(index);
+                    throw;
+                }
+
+                for (auto set : tags)
+                    set->insert(index);
+
+                auto eid = makeEntID(index);
+
+                initRow(func, eid, cols.data(), row,
+                        TypeList<Ts...>{}, MakeIndexList_t<sizeof...(Ts)>{});
+
+                notifyAll(&ObserverSet::added, eid);
+            }
+        }
+
+        /*! Reserve Entity storage.
+         *
+         * Ensures that up to count Entities can exist without the Entity
+         * table reallocating.
+         *
+         * @param count Number of Entities.
+         */
+        void reserve(size_type count)
+        {
+            entities->slots.reserve(count);
+        }
+
+        /*! Reserve component storage.
+         *
+         * Ensures that up to count Entities with exactly the components Ts
+         * can exist without allocating more component storage.
+         *
+         * @tparam Ts Component types.
+         * @param count Number of Entities.
+         */
+        template <typename... Ts>
+        void reserve(size_type count)
+        {
+            getArchetypeOf<Ts...>().reserve(count);
+        }
+
+        /*! Destroys an Entity.
+         *
+         * Destroys the given Entity and all associated components.
+         *
+         * @warning
+         * All components associated with the Entity are destroyed.
+         * This means that all references and ComIDs associated with those
+         * components are invalidated.
+         *
+         * @param eid EntID of the Entity to erase.
+         */
+        void eraseEntity(EntID eid)
+        {
+            notifyAll(&ObserverSet::removed, eid);
+            destroyEntity(eid);
+        }
+
+        /*! Test an EntID for validity.
+         *
+         * Returns true if the given EntID refers to an Entity that exists in
+         * this Database. Handles to erased Entities are detected even if
+         * their slot has since been reused.
+         *
+         * @param eid EntID to test.
+         * @return True if eid refers to a live Entity.
+         */
+        bool isValid(EntID eid) const
+        {
+            return (eid.table == entities.get() && eid.alive());
+        }
+
+        /*! Emplace an Entity into this Database.
+         *
+         * Move the given Entity into this Database.
+         *
+         * @param ent Entity rvalue to move.
+         * @return EntID to the new Entity.
+         */
+        EntID emplaceEntity(Entity&& ent)
+        {
+            vector<GUID> sig;
+            sig.reserve(ent.components.size());
+
+            for (auto const& dat : ent.components)
+                if (!dat.info->tag)
+                    sig.push_back(dat.getGUID());
+
+            auto& arch = getArchetype(sig);
+            auto index = allocEntity(arch);
+            auto row = entities->slots[index].row;
+
+            size_type i = 0;
+
+            for (auto const& dat : ent.components)
+            {
+                if (dat.info->tag)
+                {
+                    entities->tagSet(dat.getGUID()).insert(index);
+                    continue;
+                }
+
+                auto& col = arch.columns[i++];
+                col.getInfo().unbox(col.at(row), dat.ptr);
+            }
+
+            ent.components.clear();
+
+            auto eid = makeEntID(index);
+            notifyAll(&ObserverSet::added, eid);
+
+            return eid;
+        }
+
+        /*! Displace an Entity out of this Database.
+         *
+         * Moves the given Entity out of this Database.
+         *
+         * @warning
+         * All EntIDs associated with the Entity are invalidated.
+         *
+         * @param eid EntID to Entity to displace.
+         * @return Entity value.
+         */
+        Entity displaceEntity(EntID eid)
+        {
+            notifyAll(&ObserverSet::removed, eid);
+
+            Entity rv;
+            auto const& ent = getData(eid);
+            auto& arch = *ent.archetype;
+            auto row = ent.row;
+
+            rv.components.reserve(arch.columns.size());
+
+            for (auto& col : arch.columns)
+            {
+                auto const& info = col.getInfo();
+                rv.components.push_back(
+                    ComponentData(&info, info.box(col.edit(row))));
+            }
+
+            auto const& tags = entities->tags;
+
+            for (size_type guid=0; guid<tags.size(); ++guid)
+            {
+                if (!tags[guid].has(eid.index))
+                    continue;
+
+                auto const& info = *findTypeInfo(guid);
+                setComponent(rv, ComponentData(&info,
+                    info.box(tagInstance<max_align_t>())));
+            }
+
+            destroyEntity(eid);
+
+            return rv;
+        }
+
+        /*! Clone an Entity.
+         *
+         * Creates a new Entity with a copy of every component and tag of the
+         * given Entity. The copy is placed directly in the same archetype.
+         *
+         * @param eid EntID of the Entity to clone.
+         * @return EntID of the new Entity.
+         * @throws logic_error if a component is not copy-constructible.
+         */
+        EntID cloneEntity(EntID eid)
+        {
+            auto const& ent = getData(eid);
+            auto& arch = *ent.archetype;
+            auto srcRow = ent.row;
+
+            checkCopyable(arch);
+
+            auto row = spawnRows(arch, 1, [&](size_type i) -> void const* {
+                return arch.columns[i].at(srcRow);
+            });
+
+            auto index = arch.entities[row];
+
+            for (auto& set : entities->tags)
+                if (set.has(eid.index))
+                    set.insert(index);
+
+            auto rv = makeEntID(index);
+            notifyAll(&ObserverSet::added, rv);
+
+            return rv;
+        }
+
+    // Prefabs
+
+        /*! Prefab
+         *
+         * A template for Entities: a set of components with default values,
+         * made by makePrefab() and stamped out by instantiate().
+         *
+         * A Prefab knows the archetype its Entities belong to, so instancing
+         * skips the archetype search that adding components one at a time
+         * does, and copies each component straight into place.
+         *
+         * Prefabs are move-only, and must not outlive their Database.
+         */
+        class Prefab
+        {
+            friend class Database;
+
+            EntityTable const* table = nullptr;
+            Archetype* archetype = nullptr;
+
+            // One element per column of the archetype.
+            vector<Column> prototype;
+
+            vector<GUID> tags;
+
+            public:
+
+                Prefab() = default;
+                Prefab(Prefab const&) = delete;
+                Prefab(Prefab &&) = default;
+                Prefab& operator=(Prefab const&) = delete;
+                Prefab& operator=(Prefab &&) = default;
+
+                /*! Test for validity.
+                 *
+                 * @return True if this holds a prefab.
+                 */
+                explicit operator bool() const
+                {
+                    return table;
+                }
+        };
+
+        /*! Make a Prefab from values.
+         *
+         * @tparam Ts Component types. Must be distinct and
+         * copy-constructible.
+         * @param coms Default value of each component.
+         * @return Prefab with those components.
+         */
+        template <typename... Ts>
+        Prefab makePrefab(Ts... coms)
+        {
+            auto rv = startPrefab(getArchetypeOf<Ts...>());
+            int expand[] = {0, (setPrototype(rv, coms), 0)...};
+            (void)expand;
+            return rv;
+        }
+
+        /*! Make a Prefab from an Entity.
+         *
+         * Copies every component and tag of the Entity, which is left
+         * untouched.
+         *
+         * @param eid EntID of the Entity.
+         * @return Prefab with copies of its components.
+         * @throws logic_error if a component is not copy-constructible.
+         */
+        Prefab makePrefab(EntID eid)
+        {
+            auto const& ent = getData(eid);
+            auto rv = startPrefab(*ent.archetype);
+            auto const& tags = entities->tags;
+
+            for (size_type i=0; i<rv.prototype.size(); ++i)
+            {
+                auto& proto = rv.prototype[i];
+                proto.getInfo().copy(proto.at(0),
+                                     ent.archetype->columns[i].at(ent.row));
+                proto.grow();
+            }
+
+            for (size_type guid=0; guid<tags.size(); ++guid)
+                if (tags[guid].has(eid.index))
+                    rv.tags.push_back(guid);
+
+            return rv;
+        }
+
+        /*! Instantiate a Prefab.
+         *
+         * @param prefab Prefab made by this Database.
+         * @return EntID of a new Entity with copies of its components.
+         */
+        EntID instantiate(Prefab const& prefab)
+        {
+            auto row = spawnPrefab(prefab, 1);
+            auto rv = prefab.archetype->makeEntID(row);
+            notifyAll(&ObserverSet::added, rv);
+            return rv;
+        }
+
+        /*! Instantiate a Prefab many times.
+         *
+         * Creates count new Entities with copies of the Prefab's components,
+         * then calls func on each of them. Storage is allocated once up
+         * front, and each component column is filled in one pass.
+         *
+         * @tparam Ts Component types, all of which the Prefab must have.
+         * @param prefab Prefab made by this Database.
+         * @param count Number of Entities to create.
+         * @param func Callable as `func(EntID, Ts&...)`, used to adjust the
+         * components of each new Entity.
+         * @throws invalid_argument if the Prefab lacks one of Ts.
+         */
+        template <typename... Ts, typename Func>
+        void instantiate(Prefab const& prefab, size_type count, Func&& func)
+        {
+            auto& arch = *prefab.archetype;
+            array<Column*, sizeof...(Ts)> cols =
+                {{arch.findColumn(getGUID<Ts>())...}};
+            array<GUID, sizeof...(Ts)> guids = {{getGUID<Ts>()...}};
+            array<bool, sizeof...(Ts)> isTags = {{IsTag<Ts>::value...}};
+
+            for (size_type i=0; i<guids.size(); ++i)
+            {
+                auto const& tags = prefab.tags;
+
+                if (isTags[i] ? find(begin(tags), end(tags), guids[i])
+                                    == end(tags)
+                              : !cols[i])
+                {
+                    throw invalid_argument(
+                        "Ginseng: Prefab does not have component!");
+                }
+            }
+
+            auto first = spawnPrefab(prefab, count);
+
+            for (auto row=first; row<first+count; ++row)
+            {
+                auto eid = arch.makeEntID(row);
+
+                initRow(func, eid, cols.data(), row,
+                        TypeList<Ts...>{}, MakeIndexList_t<sizeof...(Ts)>{});
+
+                notifyAll(&ObserverSet::added, eid);
+            }
+        }
+
+    private:
+
+        // Prefab helpers
+
+            Prefab startPrefab(Archetype& arch)
+            {
+                checkCopyable(arch);
+
+                Prefab rv;
+                rv.table = entities.get();
+                rv.archetype = &arch;
+                rv.prototype.reserve(arch.columns.size());
+
+                for (auto const& col : arch.columns)
+                {
+                    rv.prototype.emplace_back(&col.getInfo(), 0);
+                    rv.prototype.back().pushPage();
+                }
+
+                return rv;
+            }
+
+            template <typename T>
+            void setPrototype(Prefab& prefab, T& com)
+            {
+                auto guid = getGUID<T>();
+
+                if (IsTag<T>::value)
+                {
+                    entities->tagSet(guid);
+                    prefab.tags.push_back(guid);
+                    return;
+                }
+
+                auto& proto = prefab.prototype[
+                    prefab.archetype->columnIndex[guid]];
+                ::new (proto.at(0)) T(move(com));
+                proto.grow();
+            }
+
+            // Appends count copies of prefab, returning the first row.
+            size_type spawnPrefab(Prefab const& prefab, size_type count)
+            {
+                if (prefab.table != entities.get())
+                    throw invalid_argument(
+                        "Ginseng: Prefab is from another Database!");
+
+                auto& arch = *prefab.archetype;
+                vector<TagSet*> tags;
+
+                for (auto guid : prefab.tags)
+                    entities->tagSet(guid);
+
+                for (auto guid : prefab.tags)
+                    tags.push_back(&entities->tagSet(guid));
+
+                reserve(entities->slots.size() + count);
+                arch.reserve(arch.size() + count);
+
+                auto first = spawnRows(arch, count, [&](size_type i) {
+                    return static_cast<void const*>(prefab.prototype[i].at(0));
+                });
+
+                for (auto set : tags)
+                    for (auto row=first; row<first+count; ++row)
+                        set->insert(arch.entities[row]);
+
+                return first;
+            }
+
+    public:
+
+    // Component functions
+
+        /*! Create new component.
+         *
+         * Creates a new component from the given value and associates it with
+         * the given Entity.
+         * If a component of the same type already exists, it will be
+         * overwritten.
+         *
+         * @warning
+         * All references to components that share an archetype with the
+         * given Entity will be invalidated.
+         *
+         * @param eid Entity to attach new component to.
+         * @param com Component value.
+         * @return ComInfo for the new component.
+         */
+        template <typename T>
+        ComInfo<T> makeComponent(EntID eid, T com)
+        {
+            ComID cid;
+            GUID guid = getTypeInfo<T>().guid;
+            auto& ent = getData(eid);
+            auto& arch = *ent.archetype;
+
+            cid.eid = eid;
+            cid.guid = guid;
+
+            if (IsTag<T>::value)
+            {
+                if (!entities->hasTag(guid, eid.index))
+                {
+                    entities->tagSet(guid).insert(eid.index);
+                    notify(&ObserverSet::added, guid, eid, tagInstance<T>());
+                }
+
+                return {tagInstance<T>(),cid};
+            }
+
+            if (auto col = arch.findColumn(guid))
+            {
+                T* comptr = static_cast<T*>(col->edit(ent.row));
+                *comptr = move(com);
+                col->touch(ent.row, entities->version);
+                notify(&ObserverSet::changed, guid, eid, comptr);
+                return {comptr,cid};
+            }
+
+            auto& dst = getArchetypeWith(arch, guid);
+            auto row = dst.pushRow(eid.index);
+            T* comptr = static_cast<T*>(dst.findColumn(guid)->at(row));
+
+            try
+            {
+                ::new (comptr) T(move(com));
+            }
+            catch (...)
+            {
+                dst.popRow();
+                throw;
+            }
+
+            relocate(ent, dst, row);
+            notify(&ObserverSet::added, guid, eid, comptr);
+
+            return {comptr,cid};
+        }
+
+        /*! Erase a component.
+         *
+         * Destroys the given component and disassociates it from its Entity.
+         *
+         * @warning
+         * All references to components that share an archetype with the
+         * component's Entity will be invalidated.
+         *
+         * @param cid ComID of the component to erase.
+         */
+        void eraseComponent(ComID cid)
+        {
+            if (auto ptr = findComponent(cid))
+                notify(&ObserverSet::removed, cid.guid, cid.eid, ptr);
+
+            removeComponent(cid);
+        }
+
+        /*! Remove a tag from every Entity.
+         *
+         * Takes time proportional to the number of tagged Entities, and
+         * neither allocates nor moves any components.
+         *
+         * @tparam T Tag type. Must be an empty type.
+         */
+        template <typename T>
+        void clearTag()
+        {
+            static_assert(IsTag<T>::value,
+                "Ginseng: clearTag() requires an empty component type.");
+
+            auto guid = getGUID<T>();
+
+            if (size_type(guid) >= entities->tags.size())
+                return;
+
+            auto& set = entities->tags[guid];
+
+            if (size_type(guid) < observers.size())
+                for (auto slot : set.members)
+                    notify(&ObserverSet::removed, guid, makeEntID(slot),
+                           tagInstance<T>());
+
+            set.clear();
+        }
+
+        /*! Mark a component as changed.
+         *
+         * Writes through mutable query terms, EntID::get(), ComID::cast() and
+         * the component functions are recorded automatically. Writes through
+         * a reference kept from an earlier access, or through a const_cast,
+         * are not, so they must be marked here to be seen by `Changed<T>`
+         * queries.
+         *
+         * @warning
+         * Not safe to call for Entities in the same archetype chunk from
+         * several threads at once.
+         *
+         * @tparam T Component type. Must not be a tag.
+         * @param eid Entity whose component changed.
+         */
+        template <typename T>
+        void markChanged(EntID eid)
+        {
+            static_assert(!IsTag<T>::value,
+                "Ginseng: Tags have no change tracking.");
+
+            auto const& ent = eid.getData();
+
+            auto guid = getGUID<T>();
+
+            if (auto col = ent.archetype->findColumn(guid))
+            {
+                col->touch(ent.row, entities->version);
+                notify(&ObserverSet::changed, guid, eid, col->edit(ent.row));
+            }
+        }
+
+        /*! Emplace component data into this Database.
+         *
+         * Moves the given component data into this Database and associates it
+         * with the given Entity.
+         *
+         * @warning
+         * All references to components that share an archetype with the
+         * given Entity will be invalidated.
+         *
+         * @param eid Entity to attach component to.
+         * @param dat Component data to move. Must not be empty, as
+         * displaceComponent() returns for a missing component.
+         * @return ComID to the new component.
+         * @throws invalid_argument if dat is empty.
+         */
+        ComID emplaceComponent(EntID eid, Entity::ComponentData&& dat)
+        {
+            if (!dat)
+                throw invalid_argument(
+                    "Ginseng: Cannot emplace empty component data!");
+
+            ComID rv;
+            GUID guid = dat.getGUID();
+            auto const& info = *dat.info;
+            auto& ent = getData(eid);
+            auto& arch = *ent.archetype;
+
+            rv.eid = eid;
+            rv.guid = guid;
+
+            if (info.tag)
+            {
+                if (!entities->hasTag(guid, eid.index))
+                {
+                    entities->tagSet(guid).insert(eid.index);
+                    notify(&ObserverSet::added, guid, eid,
+                           tagInstance<max_align_t>());
+                }
+
+                return rv;
+            }
+
+            if (auto col = arch.findColumn(guid))
+            {
+                info.assign(col->edit(ent.row), dat.ptr);
+                col->touch(ent.row, entities->version);
+                notify(&ObserverSet::changed, guid, eid, col->at(ent.row));
+                return rv;
+            }
+
+            auto& dst = getArchetypeWith(arch, guid);
+            auto row = dst.pushRow(eid.index);
+
+            auto ptr = dst.findColumn(guid)->at(row);
+
+            try
+            {
+                info.unbox(ptr, dat.ptr);
+            }
+            catch (...)
+            {
+                dst.popRow();
+                throw;
+            }
+
+            relocate(ent, dst, row);
+            notify(&ObserverSet::added, guid, eid, ptr);
+
+            return rv;
+        }
+
+        /*! Displace a component out of this Database.
+         *
+         * Moves the given component out of this Database.
+         *
+         * @warning
+         * All references to components that share an archetype with the
+         * component's Entity will be invalidated.
+         *
+         * @param cid ComID of the component to displace.
+         * @return Component data, or empty data if the Entity does not have
+         * the component.
+         */
+        Entity::ComponentData displaceComponent(ComID cid)
+        {
+            if (!isValid(cid.eid))
+                return {};
+
+            auto src = findComponent(cid);
+
+            if (!src)
+                return {};
+
+            auto const& info = *findTypeInfo(cid.guid);
+            notify(&ObserverSet::removed, cid.guid, cid.eid, src);
+            Entity::ComponentData rv (&info, info.box(src));
+            removeComponent(cid);
+            return rv;
+        }
+
+    // Observers
+
+        /*! Observe added components.
+         *
+         * Calls `fn(eid, com)` whenever a component of type T is added to an
+         * Entity, including Entities created with it, once the component is
+         * in place.
+         *
+         * @warning
+         * Observers must not add or remove Entities or components, nor
+         * register other observers. Structural changes can be queued in a
+         * CommandBuffer instead.
+         *
+         * @tparam T Component type.
+         * @param fn Callable as `fn(EntID, T&)`.
+         */
+        template <typename T, typename F>
+        void onAdd(F&& fn)
+        {
+            addObserver<T>(&ObserverSet::added, forward<F>(fn));
+        }
+
+        /*! Observe removed components.
+         *
+         * Calls `fn(eid, com)` whenever a component of type T is about to be
+         * removed from an Entity, displaced, or erased along with its Entity.
+         * The component is still intact when the observer runs.
+         *
+         * @warning
+         * The same restrictions as onAdd() apply.
+         *
+         * @tparam T Component type.
+         * @param fn Callable as `fn(EntID, T&)`.
+         */
+        template <typename T, typename F>
+        void onRemove(F&& fn)
+        {
+            addObserver<T>(&ObserverSet::removed, forward<F>(fn));
+        }
+
+        /*! Observe changed components.
+         *
+         * Calls `fn(eid, com)` whenever an existing component of type T is
+         * overwritten by makeComponent(), emplaceComponent() or a flushed
+         * CommandBuffer, or marked with markChanged().
+         *
+         * Writes through query terms are not observed, since observers run
+         * one at a time; use a `Changed<T>` query to pick those up.
+         *
+         * @warning
+         * The same restrictions as onAdd() apply.
+         *
+         * @tparam T Component type.
+         * @param fn Callable as `fn(EntID, T&)`.
+         */
+        template <typename T, typename F>
+        void onChange(F&& fn)
+        {
+            addObserver<T>(&ObserverSet::changed, forward<F>(fn));
+        }
+
+    // Command buffers
+
+        /*! Command Buffer
+         *
+         * Records structural changes (creating and destroying Entities,
+         * adding and removing components) so that they can be applied later
+         * by Database::flush(). Nothing in the Database is touched while
+         * recording, so commands may be queued while iterating a query, and
+         * separate buffers may be filled concurrently without locking.
+         *
+         * Commands on Entities that no longer exist when the buffer is
+         * flushed are ignored.
+         */
+        class CommandBuffer
+        {
+            friend class Database;
+
+            enum class Op
+            {
+                DESTROY,
+                ADD,
+                REMOVE
+            };
+
+            struct Command
+            {
+                EntID eid;
+                Op op;
+                GUID guid;
+                ComponentData data;
+            };
+
+            vector<Command> commands;
+            vector<Entity> created;
+
+            public:
+
+                /*! Pending Entity
+                 *
+                 * Refers to an Entity that will be created by the next flush.
+                 */
+                struct PendingID
+                {
+                    size_type index;
+                };
+
+                /*! Queue the creation of an Entity.
+                 *
+                 * @return PendingID to add components to.
+                 */
+                PendingID create()
+                {
+                    created.emplace_back();
+                    return {created.size() - 1};
+                }
+
+                /*! Queue the destruction of an Entity.
+                 *
+                 * Any other commands for the same Entity are discarded.
+                 *
+                 * @param eid EntID of the Entity to erase.
+                 */
+                void destroy(EntID eid)
+                {
+                    commands.push_back(Command{eid, Op::DESTROY, 0, {}});
+                }
+
+                /*! Queue adding a component.
+                 *
+                 * If the Entity already has a component of this type when the
+                 * buffer is flushed, it is overwritten.
+                 *
+                 * @param eid Entity to attach new component to.
+                 * @param com Component value.
+                 */
+                template <typename T>
+                void add(EntID eid, T com)
+                {
+                    auto dat = boxComponent(com);
+                    auto guid = dat.getGUID();
+                    commands.push_back(Command{eid, Op::ADD, guid, move(dat)});
+                }
+
+                /*! Add a component to a pending Entity.
+                 *
+                 * @param pid Pending Entity to attach new component to.
+                 * @param com Component value.
+                 */
+                template <typename T>
+                void add(PendingID pid, T com)
+                {
+                    setComponent(created[pid.index], boxComponent(com));
+                }
+
+                /*! Queue removing a component.
+                 *
+                 * @tparam T Type of the component to remove.
+                 * @param eid Entity to remove the component from.
+                 */
+                template <typename T>
+                void remove(EntID eid)
+                {
+                    auto guid = getTypeInfo<T>().guid;
+                    commands.push_back(Command{eid, Op::REMOVE, guid, {}});
+                }
+
+                /*! Test for pending commands.
+                 *
+                 * @return True if there is nothing to flush.
+                 */
+                bool empty() const
+                {
+                    return commands.empty() && created.empty();
+                }
+
+                /*! Discard all pending commands.
+                 */
+                void clear()
+                {
+                    commands.clear();
+                    created.clear();
+                }
+        };
+
+        /*! Apply a CommandBuffer.
+         *
+         * Applies and clears every command in the buffer. Commands are
+         * grouped by Entity so that each Entity moves between archetypes at
+         * most once, no matter how many components were added or removed.
+         * Entities are visited in descending row order within each
+         * archetype, which keeps the rows being filled in from the back as
+         * cheap as possible.
+         *
+         * @warning
+         * All references to components of affected archetypes are
+         * invalidated.
+         *
+         * @param buf CommandBuffer to apply.
+         * @return EntIDs of the created Entities, in order of creation.
+         */
+        vector<EntID> flush(CommandBuffer& buf)
+        {
+            using Command = typename CommandBuffer::Command;
+
+            auto commands = move(buf.commands);
+            auto created = move(buf.created);
+            buf.clear();
+
+            stable_sort(begin(commands), end(commands),
+                [](Command const& a, Command const& b)
+                {
+                    return a.eid.index < b.eid.index;
+                });
+
+            struct Group
+            {
+                Command* first;
+                Command* last;
+                Archetype* archetype;
+                index_type row;
+            };
+
+            vector<Group> groups;
+
+            for (auto iter = begin(commands); iter != end(commands);)
+            {
+                auto last = find_if(iter, end(commands),
+                    [&](Command const& c)
+                    {
+                        return c.eid.index != iter->eid.index;
+                    });
+
+                // Stale EntIDs may share a slot with a live Entity.
+                auto mid = stable_partition(iter, last,
+                    [&](Command const& c)
+                    {
+                        return isValid(c.eid);
+                    });
+
+                if (mid != iter)
+                {
+                    auto const& ent = getData(iter->eid);
+                    groups.push_back(Group{&*iter, &*iter + (mid - iter),
+                                           ent.archetype, ent.row});
+                }
+
+                iter = last;
+            }
+
+            sort(begin(groups), end(groups),
+                [](Group const& a, Group const& b)
+                {
+                    return (a.archetype != b.archetype
+                        ? less<Archetype*>{}(a.archetype, b.archetype)
+                        : a.row > b.row);
+                });
+
+            for (auto const& group : groups)
+                applyCommands(group.first, group.last);
+
+            vector<EntID> rv;
+            rv.reserve(created.size());
+
+            for (auto& ent : created)
+                rv.push_back(emplaceEntity(move(ent)));
+
+            return rv;
+        }
+
+    private:
+
+        // Command buffer helpers
+
+            template <typename T>
+            static ComponentData boxComponent(T& com)
+            {
+                auto const& info = getTypeInfo<T>();
+                return ComponentData(&info, info.box(&com));
+            }
+
+            // Adds dat to a detached Entity, replacing any of the same type.
+            static void setComponent(Entity& ent, ComponentData&& dat)
+            {
+                auto& coms = ent.components;
+                auto guid = dat.getGUID();
+                auto iter = lower_bound(begin(coms), end(coms), guid,
+                    [](ComponentData const& c, GUID g)
+                    {
+                        return c.getGUID() < g;
+                    });
+
+                if (iter != end(coms) && iter->getGUID() == guid)
+                    *iter = move(dat);
+                else
+                    coms.insert(iter, move(dat));
+            }
+
+            /* Applies the commands for a single live Entity, moving it to its
+             * final archetype in one step.
+             */
+            template <typename Command>
+            void applyCommands(Command* first, Command* last)
+            {
+                using Op = typename CommandBuffer::Op;
+
+                auto eid = first->eid;
+
+                for (auto iter = first; iter != last; ++iter)
+                {
+                    if (iter->op == Op::DESTROY)
+                    {
+                        eraseEntity(eid);
+                        return;
+                    }
+                }
+
+                // Only the last command for each component type matters.
+                vector<Command*> changes;
+
+                for (auto iter = first; iter != last; ++iter)
+                {
+                    auto same = find_if(begin(changes), end(changes),
+                        [&](Command* c){ return c->guid == iter->guid; });
+
+                    if (same != end(changes))
+                        *same = iter;
+                    else
+                        changes.push_back(iter);
+                }
+
+                // Tags change in place and never move the Entity.
+                auto isTagChange = [&](Command* c){ return isTag(c->guid); };
+
+                for (auto change : changes)
+                {
+                    if (!isTagChange(change))
+                        continue;
+
+                    auto& set = entities->tagSet(change->guid);
+                    auto tag = tagInstance<max_align_t>();
+
+                    if (change->op == Op::ADD && !set.has(eid.index))
+                    {
+                        set.insert(eid.index);
+                        notify(&ObserverSet::added, change->guid, eid, tag);
+                    }
+                    else if (change->op == Op::REMOVE && set.has(eid.index))
+                    {
+                        notify(&ObserverSet::removed, change->guid, eid, tag);
+                        set.erase(eid.index);
+                    }
+                }
+
+                changes.erase(remove_if(begin(changes), end(changes),
+                                        isTagChange),
+                              end(changes));
+
+                auto& ent = getData(eid);
+                auto& src = *ent.archetype;
+                auto sig = src.signature;
+
+                for (auto change : changes)
+                {
+                    auto pos = lower_bound(begin(sig), end(sig), change->guid);
+                    bool present = (pos != end(sig) && *pos == change->guid);
+
+                    if (change->op == Op::ADD && !present)
+                        sig.insert(pos, change->guid);
+                    else if (change->op == Op::REMOVE && present)
+                        sig.erase(pos);
+                }
+
+                // Overwrites happen in place, before the Entity is moved.
+                for (auto change : changes)
+                {
+                    if (change->op != Op::ADD)
+                        continue;
+
+                    if (auto col = src.findColumn(change->guid))
+                    {
+                        col->getInfo().assign(col->edit(ent.row),
+                                              change->data.ptr);
+                        col->touch(ent.row, entities->version);
+                        notify(&ObserverSet::changed, change->guid, eid,
+                               col->at(ent.row));
+                    }
+                }
+
+                if (sig == src.signature)
+                    return;
+
+                for (auto change : changes)
+                    if (change->op == Op::REMOVE)
+                        if (auto col = src.findColumn(change->guid))
+                            notify(&ObserverSet::removed, change->guid, eid,
+                                   col->edit(ent.row));
+
+                auto& dst = getArchetype(sig);
+                auto row = dst.pushRow(eid.index);
+                vector<Column*> built;
+
+                try
+                {
+                    for (auto change : changes)
+                    {
+                        if (change->op != Op::ADD || src.has(change->guid))
+                            continue;
+
+                        auto col = dst.findColumn(change->guid);
+                        col->getInfo().unbox(col->at(row), change->data.ptr);
+                        built.push_back(col);
+                    }
+                }
+                catch (...)
+                {
+                    for (auto col : built)
+                        col->getInfo().destroy(col->at(row));
+                    dst.popRow();
+                    throw;
+                }
+
+                relocate(ent, dst, row);
+
+                for (auto col : built)
+                    notify(&ObserverSet::added, col->getGUID(), eid,
+                           col->at(row));
+            }
+
+        // Bulk creation helpers
+
+            static void constructRow(Column* const*, size_type, TypeList<>)
+            {}
+
+            template <typename T, typename... Us>
+            static void constructRow(Column* const* cols, size_type row,
+                                     TypeList<T, Us...>)
+            {
+                if (IsTag<T>::value)
+                    return constructRow(cols + 1, row, TypeList<Us...>{});
+
+                T* ptr = ::new (cols[0]->at(row)) T();
+
+                try
+                {
+                    constructRow(cols + 1, row, TypeList<Us...>{});
+                }
+                catch (...)
+                {
+                    ptr->~T();
+                    throw;
+                }
+            }
+
+            template <typename Func, typename... Ts, size_t... Is>
+            static void initRow(Func& func, EntID eid, Column* const* cols,
+                                size_type row, TypeList<Ts...>,
+                                IndexList<Is...>)
+            {
+                (void)cols;
+                (void)row;
+                func(eid, *rowElement<Ts>(cols[Is], row)...);
+            }
+
+        // Query helpers
+
+            template <typename... Coms>
+            static array<GUID, sizeof...(Coms)> getGUIDs(TypeList<Coms...>)
+            {
+                return {{getGUID<Coms>()...}};
+            }
+
+            template <typename... Coms>
+            static array<bool, sizeof...(Coms)> getTagFlags(TypeList<Coms...>)
+            {
+                return {{IsTag<Coms>::value...}};
+            }
+
+            template <typename Guids, typename Cols, typename... Coms,
+                      size_t... Is>
+            static tuple<EntID, ComInfo<Coms>...> makeElement(
+                EntID eid, Guids const& guids, Cols const& cols,
+                size_type row, TypeList<Coms...>, IndexList<Is...>)
+            {
+                return tuple<EntID, ComInfo<Coms>...>(eid, makeInfo<Coms>(
+                    eid, guids[Is], rowElement<Coms>(cols[Is], row))...);
+            }
+
+            /* Like makeElement(), but only reads the row. Mutable elements
+             * are left pending, so that they own their page when accessed.
+             */
+            template <typename Guids, typename Cols, typename... Coms,
+                      size_t... Is>
+            static tuple<EntID, ComInfo<Coms>...> makeResult(
+                EntID eid, Guids const& guids, Cols const& cols,
+                size_type row, TypeList<Coms...>, IndexList<Is...>)
+            {
+                auto rv = makeElement(eid, guids, cols, row,
+                    TypeList<Coms const...>{}, IndexList<Is...>{});
+
+                return tuple<EntID, ComInfo<Coms>...>(eid, makePending<Coms>(
+                    std::get<Is + 1>(rv))...);
+            }
+
+            template <typename Com>
+            static ComInfo<Com> makePending(ComInfo<Com const> const& info)
+            {
+                ComInfo<Com> rv (const_cast<Com*>(info.ptr), info.cid);
+                rv.pending = (!is_const<Com>::value && !IsTag<Com>::value);
+                return rv;
+            }
+
+            template <typename... Coms>
+            static array<bool, sizeof...(Coms)> getWriteFlags(TypeList<Coms...>)
+            {
+                return {{(!is_const<Coms>::value && !IsTag<Coms>::value)...}};
+            }
+
+            // Stamps a row written through a mutable query term.
+            template <typename Com>
+            static void touchRow(Column const* col, size_type row, Version v)
+            {
+                if (!is_const<Com>::value && !IsTag<Com>::value)
+                    col->touch(row, v);
+            }
+
+            // Like touchRow(), but leaves the page stamp to the caller.
+            template <typename Com>
+            static void stampRow(Column const* col, size_type row, Version v)
+            {
+                if (!is_const<Com>::value && !IsTag<Com>::value)
+                    col->stamp(row, v);
+            }
+
+            template <typename Com>
+            static ComInfo<Com> makeInfo(EntID eid, GUID guid, Com* ptr)
+            {
+                ComID cid;
+                cid.eid = eid;
+                cid.guid = guid;
+                return {ptr, cid};
+            }
+
+            // Visits the rows of one chunk.
+            template <typename Cache, typename Match, typename F,
+                      typename... Coms, size_t... Is>
+            static void forEachIn(Cache const& cache, Match const& m,
+                                  size_type chunk, Version v, F& fn,
+                                  TypeList<Coms...>, IndexList<Is...>)
+            {
+                if (!cache.chunkChanged(m, chunk))
+                    return;
+
+                auto const& arch = *m.arch;
+                auto first = chunk << arch.shift;
+                auto last = min(arch.size(),
+                                first + (size_type(1) << arch.shift));
+                array<void*, sizeof...(Coms)> bases = {{
+                    rowBase<Coms>(m.cols[Is], first)...}};
+                (void)bases;
+
+                bool filtered = cache.filtered();
+                bool tracked = cache.tracked();
+
+                for (auto row=first; row<last; ++row)
+                {
+                    if (filtered && !cache.accepts(*arch.table,
+                                                   arch.entities[row]))
+                    {
+                        continue;
+                    }
+
+                    if (tracked && !cache.rowChanged(m, row))
+                        continue;
+
+                    int expand[] = {0, (touchRow<Coms>(m.cols[Is], row, v),
+                                        0)...};
+                    (void)expand;
+
+                    auto eid = arch.makeEntID(row);
+                    fn(eid, element<Coms>(bases[Is], row-first)...);
+                }
+            }
+
+            /* Visits one member of a tag, if it matches.
+             * Page stamps are left to Cache::touchPages(), since members of
+             * one page may be visited from several threads.
+             */
+            template <typename Cache, typename F, typename... Coms,
+                      size_t... Is>
+            static void forEachTagged(Cache const& cache,
+                                      EntityTable const& table,
+                                      index_type slot, Version v, F& fn,
+                                      TypeList<Coms...>, IndexList<Is...>)
+            {
+                auto const& ent = table.slots[slot];
+                auto match = cache.matchIndex(*ent.archetype);
+
+                if (match == NO_INDEX || !cache.accepts(table, slot))
+                    return;
+
+                auto const& m = cache.matches[match];
+
+                if (cache.tracked() && !cache.rowChanged(m, ent.row))
+                    return;
+
+                int expand[] = {0, (stampRow<Coms>(m.cols[Is], ent.row, v),
+                                    0)...};
+                (void)expand;
+
+                fn(m.arch->makeEntID(ent.row),
+                   *rowElement<Coms>(m.cols[Is], ent.row)...);
+            }
+
+            // Owns the pages a forEachTagged() call may write.
+            template <typename Cache, typename... Coms, size_t... Is>
+            static void ownTagged(Cache const& cache, EntityTable const& table,
+                                  index_type slot, TypeList<Coms...>,
+                                  IndexList<Is...>)
+            {
+                auto const& ent = table.slots[slot];
+                auto match = cache.matchIndex(*ent.archetype);
+
+                if (match == NO_INDEX)
+                    return;
+
+                auto const& m = cache.matches[match];
+                int expand[] = {0, (rowBase<Coms>(m.cols[Is], ent.row),
+                                    0)...};
+                (void)expand;
+            }
+
+            static size_type chunksIn(Archetype const& arch)
+            {
+                return (arch.size() + (size_type(1) << arch.shift) - 1)
+                    >> arch.shift;
+            }
+
+    public:
+
+    // QueryCache
+
+        /*! Query Cache
+         *
+         * The persistent state of a query: its matching archetypes, along with
+         * the columns to read from each of them.
+         *
+         * A Database creates one QueryCache per distinct query, the first time
+         * that query is used. Entities entering or leaving a matching
+         * archetype are picked up automatically, so only the creation of a new
+         * archetype requires any work from the cache.
+         *
+         * @tparam Ts Query properties.
+         */
+        template <typename... Ts>
+        class QueryCache
+            : public QueryCacheBase
+        {
+            friend class Database;
+
+            using Traits = QueryTraits<Database, Ts...>;
+            using Coms = typename Traits::components;
+            using Nots = typename Traits::nots;
+            using ChangedComs = typename Traits::changed;
+            using Guids = decltype(getGUIDs(Coms{}));
+            using Cols = array<Column const*, tuple_size<Guids>::value>;
+            using Indices = MakeIndexList_t<tuple_size<Guids>::value>;
+            using ChangedGuids = decltype(getGUIDs(ChangedComs{}));
+            using ChangedCols =
+                array<Column const*, tuple_size<ChangedGuids>::value>;
+
+            static_assert(is_same<TypeListFilter_t<ChangedComs, IsTag>,
+                                  TypeList<>>::value,
+                "Ginseng: Tags have no change tracking.");
+
+            struct Match
+            {
+                Archetype const* arch;
+                Cols cols;
+                ChangedCols changedCols;
+            };
+
+            Guids guids;
+            decltype(getWriteFlags(Coms{})) writes;
+            ComponentMask required;
+            ComponentMask excluded;
+            vector<Match> matches;
+
+            ChangedGuids changedGuids;
+
+            // Versions newer than since are changes for the current run.
+            mutable Version since = 0;
+            mutable Version lastRun = 0;
+
+            // Tags are not part of archetypes, so they are tested per Entity.
+            vector<GUID> requiredTags;
+            vector<GUID> excludedTags;
+
+            // Index into matches by archetype id, or NO_INDEX.
+            vector<index_type> matchIndices;
+
+            public:
+
+                QueryCache()
+                    : guids(getGUIDs(Coms{}))
+                    , writes(getWriteFlags(Coms{}))
+                    , changedGuids(getGUIDs(ChangedComs{}))
+                {
+                    auto tags = getTagFlags(Coms{});
+
+                    for (size_type i=0; i<guids.size(); ++i)
+                    {
+                        if (tags[i])
+                            requiredTags.push_back(guids[i]);
+                        else
+                            addToMask(required, guids[i]);
+                    }
+
+                    auto nots = getGUIDs(Nots{});
+                    auto notTags = getTagFlags(Nots{});
+
+                    for (size_type i=0; i<nots.size(); ++i)
+                    {
+                        if (notTags[i])
+                            excludedTags.push_back(nots[i]);
+                        else
+                            addToMask(excluded, nots[i]);
+                    }
+
+                    for (auto guid : changedGuids)
+                        addToMask(required, guid);
+                }
+
+                void inspect(Archetype const& arch) override
+                {
+                    if ((arch.mask & required) != required
+                        || (arch.mask & excluded).any())
+                    {
+                        return;
+                    }
+
+                    Match match;
+                    match.arch = &arch;
+
+                    for (size_type i=0; i<guids.size(); ++i)
+                        match.cols[i] = arch.findColumn(guids[i]);
+
+                    for (size_type i=0; i<changedGuids.size(); ++i)
+                        match.changedCols[i] = arch.findColumn(changedGuids[i]);
+
+                    if (matchIndices.size() <= arch.id)
+                        matchIndices.resize(arch.id + 1, NO_INDEX);
+
+                    matchIndices[arch.id] = matches.size();
+                    matches.push_back(match);
+                }
+
+                index_type matchIndex(Archetype const& arch) const
+                {
+                    return (arch.id < matchIndices.size()
+                        ? matchIndices[arch.id]
+                        : NO_INDEX);
+                }
+
+                // True if some terms must be tested per Entity.
+                bool filtered() const
+                {
+                    return !requiredTags.empty() || !excludedTags.empty();
+                }
+
+                bool accepts(EntityTable const& table, index_type slot) const
+                {
+                    for (auto guid : requiredTags)
+                        if (!table.hasTag(guid, slot))
+                            return false;
+
+                    for (auto guid : excludedTags)
+                        if (table.hasTag(guid, slot))
+                            return false;
+
+                    return true;
+                }
+
+                // True if the query has Changed terms.
+                bool tracked() const
+                {
+                    return !changedGuids.empty();
+                }
+
+                /* Starts a run of the query, and returns the version that its
+                 * writes are stamped with.
+                 *
+                 * A tracked query takes the current version for itself and
+                 * advances the clock, so the run sees every write made since
+                 * its previous run, but not its own writes.
+                 */
+                Version beginRun(EntityTable const& table) const
+                {
+                    if (!tracked())
+                        return table.version;
+
+                    auto v = table.version++;
+                    since = lastRun;
+                    lastRun = v;
+                    return v;
+                }
+
+                bool chunkChanged(Match const& m, size_type chunk) const
+                {
+                    for (auto col : m.changedCols)
+                        if (col->getPageVersion(chunk) > since)
+                            return true;
+
+                    return !tracked();
+                }
+
+                bool rowChanged(Match const& m, size_type row) const
+                {
+                    for (auto col : m.changedCols)
+                        if (col->getVersion(row) > since)
+                            return true;
+
+                    return false;
+                }
+
+                // Stamps every page that a tag-driven run may have written.
+                void touchPages(Version v) const
+                {
+                    for (auto const& m : matches)
+                    {
+                        for (size_type i=0; i<writes.size(); ++i)
+                        {
+                            if (!writes[i])
+                                continue;
+
+                            for (size_type c=0, e=chunksIn(*m.arch); c<e; ++c)
+                                m.cols[i]->touchPage(c, v);
+                        }
+                    }
+                }
+
+                // Number of rows in the matching archetypes.
+                size_type rows() const
+                {
+                    size_type rv = 0;
+
+                    for (auto const& m : matches)
+                        rv += m.arch->size();
+
+                    return rv;
+                }
+
+                /* Plans a run. Returns the smallest TagSet of a required tag
+                 * if it has fewer members than the matching archetypes have
+                 * rows; its members are then visited and the other terms
+                 * probed per Entity. Null if the archetypes should be walked
+                 * instead.
+                 */
+                TagSet const* driver(EntityTable const& table) const
+                {
+                    TagSet const* rv = nullptr;
+
+                    for (auto guid : requiredTags)
+                    {
+                        if (size_type(guid) >= table.tags.size())
+                            return &emptyTagSet();
+
+                        auto const& set = table.tags[guid];
+
+                        if (!rv || set.members.size() < rv->members.size())
+                            rv = &set;
+                    }
+
+                    if (rv && rv->members.size() >= rows())
+                        return nullptr;
+
+                    return rv;
+                }
+
+                // Upper bound on the number of results.
+                size_type estimate(EntityTable const& table) const
+                {
+                    if (auto set = driver(table))
+                        return set->members.size();
+
+                    return rows();
+                }
+        };
+
+        /*! Get the QueryCache for a query.
+         *
+         * Creates and registers the cache on first use.
+         *
+         * @tparam Ts Query properties.
+         * @return The persistent cache for the query.
+         */
+        template <typename... Ts>
+        QueryCache<Ts...> const& getQueryCache() const
+        {
+            return getCache<QueryCache<Ts...>>(getQueryID<Ts...>());
+        }
+
+    private:
+
+        // Cache helpers
+
+            // Creates and registers a cache of type Cache under id.
+            template <typename Cache>
+            Cache const& getCache(size_t id) const
+            {
+                lock_guard<mutex> lock (entities->cacheMutex);
+
+                if (queryCaches.size() <= id)
+                    queryCaches.resize(id + 1);
+
+                auto& cache = queryCaches[id];
+
+                if (!cache)
+                {
+                    auto ptr = make_unique<Cache>();
+
+                    for (auto const& arch : archetypes)
+                        ptr->inspect(*arch);
+
+                    cache = move(ptr);
+                }
+
+                return static_cast<Cache const&>(*cache);
+            }
+
+    public:
+
+    // View
+
+        /*! Query View
+         *
+         * A lazily evaluated query over a QueryCache. No memory is allocated,
+         * and only matching archetypes are visited.
+         *
+         * Iterating a View yields the same elements as query(), constructed
+         * on the fly and returned by value.
+         *
+         * @warning
+         * Adding or removing Entities or components while iterating a View
+         * invalidates its iterators.
+         *
+         * @tparam Ts Query properties.
+         */
+        template <typename... Ts>
+        class View
+        {
+            friend class Database;
+
+            using Cache = QueryCache<Ts...>;
+            using Traits = QueryTraits<Database, Ts...>;
+
+            Cache const* cache;
+            Version version;
+
+            View(Cache const* c, Version v)
+                : cache(c)
+                , version(v)
+            {}
+
+            public:
+
+                using value_type = typename Traits::result_element;
+
+                /*! View iterator
+                 *
+                 * Dereferencing yields a query element by value.
+                 */
+                class iterator
+                {
+                    friend class View;
+
+                    Cache const* cache = nullptr;
+                    Version version = 0;
+                    size_type match = 0;
+                    size_type row = 0;
+
+                    iterator(Cache const* c, Version v, size_type m)
+                        : cache(c)
+                        , version(v)
+                        , match(m)
+                    {
+                        seek();
+                    }
+
+                    // Advances to the next matching row, if this is not one.
+                    void seek()
+                    {
+                        auto const& matches = cache->matches;
+
+                        while (match < matches.size())
+                        {
+                            auto const& arch = *matches[match].arch;
+
+                            if (row == arch.size())
+                            {
+                                row = 0;
+                                ++match;
+                            }
+                            else if ((!cache->filtered()
+                                    || cache->accepts(*arch.table,
+                                                      arch.entities[row]))
+                                && (!cache->tracked()
+                                    || cache->rowChanged(matches[match], row)))
+                            {
+                                return;
+                            }
+                            else
+                            {
+                                ++row;
+                            }
+                        }
+                    }
+
+                    public:
+
+                        using iterator_category = forward_iterator_tag;
+                        using value_type = typename View::value_type;
+                        using difference_type = ptrdiff_t;
+                        using pointer = void;
+                        using reference = value_type;
+
+                        iterator() = default;
+
+                        reference operator*() const
+                        {
+                            auto const& m = cache->matches[match];
+                            auto eid = m.arch->makeEntID(row);
+
+                            for (size_type i=0; i<m.cols.size(); ++i)
+                                if (cache->writes[i])
+                                    m.cols[i]->touch(row, version);
+
+                            return makeElement(eid, cache->guids, m.cols, row,
+                                typename Cache::Coms{},
+                                typename Cache::Indices{});
+                        }
+
+                        iterator& operator++()
+                        {
+                            ++row;
+                            seek();
+                            return *this;
+                        }
+
+                        iterator operator++(int)
+                        {
+                            auto rv = *this;
+                            ++*this;
+                            return rv;
+                        }
+
+                        bool operator==(iterator const& other) const
+                        {
+                            return (match == other.match && row == other.row);
+                        }
+
+                        bool operator!=(iterator const& other) const
+                        {
+                            return !(*this == other);
+                        }
+                };
+
+                iterator begin() const
+                {
+                    return iterator(cache, version, 0);
+                }
+
+                iterator end() const
+                {
+                    return iterator(cache, version, cache->matches.size());
+                }
+        };
+
+        /*! Create a query View.
+         *
+         * Returns a lazily evaluated View of the Entities that match the given
+         * query properties. See query() for the meaning of the properties.
+         *
+         * The first use of a query registers a persistent QueryCache for it,
+         * so later Views only visit the archetypes that match.
+         *
+         * Components requested as `T` are marked changed when their element
+         * is dereferenced. If the query has `Changed<...>` terms, creating
+         * the View counts as one run of it.
+         *
+         * @tparam Ts Query properties.
+         * @return View of matching Entities.
+         */
+        template <typename... Ts>
+        View<Ts...> view() const
+        {
+            auto const& cache = getQueryCache<Ts...>();
+            return View<Ts...>(&cache, cache.beginRun(*entities));
+        }
+
+        /*! Visit each matching Entity.
+         *
+         * Calls `fn(eid, coms...)` for each Entity that matches the given
+         * query properties, where `coms` are references to the Entity's
+         * components in the order given by the positive properties.
+         *
+         * The callback is invoked directly from a loop over each archetype's
+         * columns, so it can be inlined. If the query requires tags and the
+         * rarest of them has fewer members than the matching archetypes have
+         * rows, only the members of that tag are visited.
+         *
+         * Components requested as `T` are marked changed for each visited
+         * Entity; request `const T` for components that are only read.
+         *
+         * @warning
+         * The callback must not add or remove Entities or components.
+         *
+         * @tparam Ts Query properties.
+         * @param fn Callback.
+         */
+        template <typename... Ts, typename F>
+        void for_each(F&& fn) const
+        {
+            using Cache = QueryCache<Ts...>;
+
+            auto const& cache = getQueryCache<Ts...>();
+            auto v = cache.beginRun(*entities);
+
+            if (auto set = cache.driver(*entities))
+            {
+                for (auto slot : set->members)
+                    forEachTagged(cache, *entities, slot, v, fn,
+                                  typename Cache::Coms{},
+                                  typename Cache::Indices{});
+                cache.touchPages(v);
+                return;
+            }
+
+            for (auto const& m : cache.matches)
+                for (size_type c=0, e=chunksIn(*m.arch); c<e; ++c)
+                    forEachIn(cache, m, c, v, fn, typename Cache::Coms{},
+                              typename Cache::Indices{});
+        }
+
+        /*! Visit each matching Entity in parallel.
+         *
+         * Like for_each(), but archetype chunks are spread over the threads
+         * of a ThreadPool. Each chunk holds about 16 KiB of components, and
+         * every Entity is visited exactly once.
+         *
+         * Components requested as `const T` are only read, so any number of
+         * threads may share them; components requested as `T` are written,
+         * but only by the thread visiting their Entity.
+         *
+         * @warning
+         * The callback must not add or remove Entities or components.
+         * Structural changes can be queued in a CommandBuffer per thread
+         * instead.
+         *
+         * @tparam Ts Query properties.
+         * @param pool Pool to run on.
+         * @param fn Callback. Must be safe to call from several threads.
+         */
+        template <typename... Ts, typename F>
+        void par_for_each(ThreadPool& pool, F&& fn) const
+        {
+            using Cache = QueryCache<Ts...>;
+            using Match = typename Cache::Match;
+
+            auto const& cache = getQueryCache<Ts...>();
+            auto v = cache.beginRun(*entities);
+
+            if (auto set = cache.driver(*entities))
+            {
+                auto const& members = set->members;
+                auto table = entities.get();
+                size_type const block = 1024;
+
+                // Pages shared with a Snapshot are copied before going wide.
+                if (any_of(begin(cache.writes), end(cache.writes),
+                           [](bool w){ return w; }))
+                {
+                    for (auto slot : members)
+                        ownTagged(cache, *table, slot,
+                                  typename Cache::Coms{},
+                                  typename Cache::Indices{});
+                }
+
+                pool.parallelFor((members.size() + block - 1) / block,
+                    [&](size_t i)
+                    {
+                        auto last = min(members.size(), (i + 1) * block);
+
+                        for (auto j = i * block; j < last; ++j)
+                            forEachTagged(cache, *table, members[j], v, fn,
+                                          typename Cache::Coms{},
+                                          typename Cache::Indices{});
+                    });
+
+                cache.touchPages(v);
+                return;
+            }
+
+            struct Task
+            {
+                Match const* match;
+                size_type chunk;
+            };
+
+            vector<Task> tasks;
+
+            for (auto const& m : cache.matches)
+                for (size_type c=0, e=chunksIn(*m.arch); c<e; ++c)
+                    if (cache.chunkChanged(m, c))
+                        tasks.push_back(Task{&m, c});
+
+            pool.parallelFor(tasks.size(), [&](size_t i)
+            {
+                auto const& task = tasks[i];
+                forEachIn(cache, *task.match, task.chunk, v, fn,
+                          typename Cache::Coms{}, typename Cache::Indices{});
+            });
+        }
+
+        /*! Visit each matching Entity in parallel.
+         *
+         * Runs par_for_each() on the defaultThreadPool().
+         *
+         * @tparam Ts Query properties.
+         * @param fn Callback. Must be safe to call from several threads.
+         */
+        template <typename... Ts, typename F>
+        void par_for_each(F&& fn) const
+        {
+            par_for_each<Ts...>(defaultThreadPool(), fn);
+        }
+
+    // query
+
+        /*! Query the Database.
+         *
+         * Queries the Database for Entities that match the given template
+         * properties.
+         *
+         * Template properties can be one of the following:
+         *
+         * - A component type.
+         * - A list of component types in `Not<...>`.
+         * - A list of component types in `Changed<...>`.
+         * - A `Tracker<Key>`, for any type Key.
+         *
+         * If a property is a component type, only Entities that contain that
+         * component will be returned.
+         *
+         * If a property is a list of component types in `Not<...>`, only
+         * Entities that do not contain those types will be returned.
+         *
+         * If a property is a list of component types in `Changed<...>`, only
+         * Entities that contain those types, and have had at least one of
+         * them added or written since the previous run of the same query,
+         * will be returned. The first run sees every Entity. Writes made by
+         * the run itself are not seen by the next one.
+         *
+         * @warning
+         * Changed state belongs to the query type, not to the caller. If two
+         * callers issue the same Changed query, each consumes the other's
+         * changes. Add a distinct `Tracker<Key>` to each, such as
+         * `db.for_each<Changed<X>, X, Tracker<MySystem>>(fn)`, to give each
+         * its own state. A Tracker matches every Entity and adds no element.
+         *
+         * A vector of query elements is returned.
+         *
+         * A query element is a tuple containing an EntID and a series of
+         * component elements.
+         *
+         * A component element is a ComInfo for the component.
+         *
+         * There will be a component element for each component type given in
+         * the property list.
+         *
+         * For example, if `db.query<X,Y,Not<Z>>()` is called, its return type
+         * will be determined as follows:
+         *
+         * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~{.cpp}
+         * using QueryEle = std::tuple<EntID,ComInfo<X>,ComInfo<Y>>;
+         * using QueryResult = std::vector<QueryEle>;
+         * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+         *
+         * It is important to note that the return type of
+         * `db.query<X,Y,Not<Z>>()` will be the same as the return type of
+         * `db.query<X,Y>()`.
+         *
+         * A query that requires a rare tag only visits that tag's members.
+         *
+         * Gathering the results only reads the Database: no page shared with
+         * a Snapshot is copied, and no component is marked changed. A
+         * mutable component is, the first time data() is called on its
+         * ComInfo.
+         *
+         * Prefer view() or for_each() for iteration; query() is useful when
+         * the results must outlive changes to the Database's structure.
+         *
+         * @tparam Ts Query properties.
+         * @return Query results.
+         */
+        template <typename... Ts>
+        typename QueryTraits<Database, Ts...>::result query() const
+        {
+            using Cache = QueryCache<Ts...>;
+
+            typename QueryTraits<Database, Ts...>::result rv;
+            auto const& cache = getQueryCache<Ts...>();
+            auto const& table = *entities;
+
+            cache.beginRun(table);
+            rv.reserve(cache.estimate(table));
+
+            auto collect = [&](typename Cache::Match const& m, size_type row)
+            {
+                if (cache.tracked() && !cache.rowChanged(m, row))
+                    return;
+
+                rv.push_back(makeResult(m.arch->makeEntID(row), cache.guids,
+                    m.cols, row, typename Cache::Coms{},
+                    typename Cache::Indices{}));
+            };
+
+            if (auto set = cache.driver(table))
+            {
+                for (auto slot : set->members)
+                {
+                    auto const& ent = table.slots[slot];
+                    auto match = cache.matchIndex(*ent.archetype);
+
+                    if (match != NO_INDEX && cache.accepts(table, slot))
+                        collect(cache.matches[match], ent.row);
+                }
+
+                return rv;
+            }
+
+            for (auto const& m : cache.matches)
+            {
+                auto const& arch = *m.arch;
+
+                for (size_type row=0; row<arch.size(); ++row)
+                    if (!cache.filtered()
+                        || cache.accepts(table, arch.entities[row]))
+                    {
+                        collect(m, row);
+                    }
+            }
+
+            return rv;
+        }
+
+        /*! Count the Entities that have a component.
+         *
+         * Runs in constant time.
+         *
+         * @tparam T Component type.
+         * @return Number of Entities with a T.
+         */
+        template <typename T>
+        size_type poolSize() const
+        {
+            auto guid = getGUID<T>();
+            auto const& table = *entities;
+
+            if (IsTag<T>::value)
+                return (size_type(guid) < table.tags.size()
+                    ? table.tags[guid].members.size()
+                    : 0);
+
+            return (size_type(guid) < table.population.size()
+                ? table.population[guid]
+                : 0);
+        }
+
+    // Secondary indexes
+
+        /*! Hash Index
+         *
+         * Finds the Entities whose component has a given key. For use with
+         * index().
+         *
+         * @tparam T Component type.
+         * @tparam KeyFn Default-constructible callable as `KeyFn{}(com)`,
+         * returning a key that std::hash and == accept.
+         */
+        template <typename T, typename KeyFn>
+        class HashIndex
+        {
+            public:
+
+                using Component = T;
+                using Key = decay_t<decltype(KeyFn{}(declval<T const&>()))>;
+
+            private:
+
+                using Buckets = unordered_map<Key, vector<EntID>>;
+                using Bucket = typename Buckets::value_type;
+
+                struct Entry
+                {
+                    Bucket* bucket = nullptr;
+                    index_type pos = 0;
+                };
+
+                Buckets buckets;
+
+                // By slot.
+                vector<Entry> entries;
+
+            public:
+
+                void set(EntID eid, T const& com)
+                {
+                    decltype(auto) key = KeyFn{}(com);
+
+                    if (eid.index < entries.size()
+                        && entries[eid.index].bucket)
+                    {
+                        auto const& entry = entries[eid.index];
+
+                        if (entry.bucket->first == key)
+                        {
+                            entry.bucket->second[entry.pos] = eid;
+                            return;
+                        }
+
+                        erase(eid);
+                    }
+
+                    if (entries.size() <= eid.index)
+                        entries.resize(eid.index + 1);
+
+                    auto& bucket = *buckets.emplace(
+                        key, vector<EntID>()).first;
+                    auto& entry = entries[eid.index];
+                    entry.bucket = &bucket;
+                    entry.pos = bucket.second.size();
+                    bucket.second.push_back(eid);
+                }
+
+                void erase(EntID eid)
+                {
+                    if (eid.index >= entries.size()
+                        || !entries[eid.index].bucket)
+                    {
+                        return;
+                    }
+
+                    auto& entry = entries[eid.index];
+                    auto& members = entry.bucket->second;
+
+                    members[entry.pos] = members.back();
+                    entries[members[entry.pos].index].pos = entry.pos;
+                    members.pop_back();
+
+                    if (members.empty())
+                        buckets.erase(buckets.find(entry.bucket->first));
+
+                    entry.bucket = nullptr;
+                }
+
+                /*! Find Entities by key.
+                 *
+                 * @param key Key to look up.
+                 * @return Every Entity whose component has that key, in no
+                 * particular order.
                  */
-                template <typename... Ts>
-                tuple<ComInfo<Ts>...> getComs() const
+                vector<EntID> const& find(Key const& key) const
                 {
-                    return make_tuple(get<Ts>()...);
+                    static vector<EntID> const none;
+                    auto iter = buckets.find(key);
+                    return (iter != buckets.end() ? iter->second : none);
                 }
+        };
 
-                /*! Compares this EntID to another for equivalence.
+        /*! Grid Index
+         *
+         * Finds the Entities whose component lies in a rectangle, by sorting
+         * them into the cells of a uniform grid. For use with index().
+         *
+         * Cells are hashed, so the grid is unbounded and empty cells cost
+         * nothing. A lookup visits every cell the rectangle overlaps, or
+         * every occupied cell if that is fewer.
+         *
+         * @tparam T Component type.
+         * @tparam PointFn Default-constructible callable as `PointFn{}(com)`,
+         * returning a `pair<double,double>` of x and y.
+         */
+        template <typename T, typename PointFn>
+        class GridIndex
+        {
+            public:
+
+                using Component = T;
+
+            private:
+
+                struct Member
+                {
+                    EntID eid;
+                    double x;
+                    double y;
+                };
+
+                using Cells = unordered_map<uint64_t, vector<Member>>;
+                using Cell = typename Cells::value_type;
+
+                struct Entry
+                {
+                    Cell* cell = nullptr;
+                    index_type pos = 0;
+                };
+
+                double cellSize;
+                Cells cells;
+
+                // By slot.
+                vector<Entry> entries;
+
+                int32_t coord(double v) const
+                {
+                    auto c = floor(v / cellSize);
+                    c = max(c, double(numeric_limits<int32_t>::min()));
+                    c = min(c, double(numeric_limits<int32_t>::max()));
+                    return int32_t(c);
+                }
+
+                static uint64_t cellKey(int32_t cx, int32_t cy)
+                {
+                    return (uint64_t(uint32_t(cx)) << 32) | uint32_t(cy);
+                }
+
+            public:
+
+                /*! Constructor.
                  *
-                 * Returns true only if the two EntIDs are handles to the same
-                 * Entity.
+                 * @param size Width and height of each cell. Lookups are
+                 * fastest when it is near the size of the rectangles looked
+                 * up.
+                 */
+                explicit GridIndex(double size = 64)
+                    : cellSize(size)
+                {}
+
+                void set(EntID eid, T const& com)
+                {
+                    auto point = pair<double,double>(PointFn{}(com));
+                    auto key = cellKey(coord(point.first),
+                                       coord(point.second));
+
+                    if (eid.index < entries.size() && entries[eid.index].cell)
+                    {
+                        auto const& entry = entries[eid.index];
+
+                        if (entry.cell->first == key)
+                        {
+                            auto& member = entry.cell->second[entry.pos];
+                            member.eid = eid;
+                            member.x = point.first;
+                            member.y = point.second;
+                            return;
+                        }
+
+                        erase(eid);
+                    }
+
+                    if (entries.size() <= eid.index)
+                        entries.resize(eid.index + 1);
+
+                    auto& cell = *cells.emplace(key, vector<Member>()).first;
+                    auto& entry = entries[eid.index];
+                    entry.cell = &cell;
+                    entry.pos = cell.second.size();
+                    cell.second.push_back({eid, point.first, point.second});
+                }
+
+                void erase(EntID eid)
+                {
+                    if (eid.index >= entries.size() || !entries[eid.index].cell)
+                        return;
+
+                    auto& entry = entries[eid.index];
+                    auto& members = entry.cell->second;
+
+                    members[entry.pos] = members.back();
+                    entries[members[entry.pos].eid.index].pos = entry.pos;
+                    members.pop_back();
+
+                    if (members.empty())
+                        cells.erase(cells.find(entry.cell->first));
+
+                    entry.cell = nullptr;
+                }
+
+                /*! Visit the Entities in a rectangle.
                  *
-                 * @param other The EntID to compare to this.
-                 * @return True if EntIDs are equivalent.
+                 * Calls `fn(eid)` for each Entity whose point lies within the
+                 * rectangle, bounds included, in no particular order.
+                 *
+                 * @param left Least x.
+                 * @param bottom Least y.
+                 * @param right Greatest x.
+                 * @param top Greatest y.
+                 * @param fn Callback.
                  */
-                bool operator==(EntID const& other) const
+                template <typename F>
+                void forEachIn(double left, double bottom, double right,
+                               double top, F&& fn) const
+                {
+                    if (left > right || bottom > top)
+                        return;
+
+                    auto x0 = coord(left);
+                    auto x1 = coord(right);
+                    auto y0 = coord(bottom);
+                    auto y1 = coord(top);
+
+                    auto visit = [&](vector<Member> const& members)
+                    {
+                        for (auto const& m : members)
+                        {
+                            if (m.x >= left && m.x <= right
+                                && m.y >= bottom && m.y <= top)
+                            {
+                                fn(m.eid);
+                            }
+                        }
+                    };
+
+                    auto area = (double(x1) - x0 + 1) * (double(y1) - y0 + 1);
+
+                    if (area > cells.size())
+                    {
+                        for (auto const& cell : cells)
+                        {
+                            auto cx = int32_t(uint32_t(cell.first >> 32));
+                            auto cy = int32_t(uint32_t(cell.first));
+
+                            if (cx >= x0 && cx <= x1 && cy >= y0 && cy <= y1)
+                                visit(cell.second);
+                        }
+
+                        return;
+                    }
+
+                    for (auto cx=int64_t(x0); cx<=x1; ++cx)
+                        for (auto cy=int64_t(y0); cy<=y1; ++cy)
+                        {
+                            auto iter = cells.find(
+                                cellKey(int32_t(cx), int32_t(cy)));
+
+                            if (iter != cells.end())
+                                visit(iter->second);
+                        }
+                }
+
+                /*! Find the Entities in a rectangle.
+                 *
+                 * @param left Least x.
+                 * @param bottom Least y.
+                 * @param right Greatest x.
+                 * @param top Greatest y.
+                 * @return Every Entity whose point lies within the rectangle,
+                 * bounds included, in no particular order.
+                 */
+                vector<EntID> queryRect(double left, double bottom,
+                                        double right, double top) const
+                {
+                    vector<EntID> rv;
+                    forEachIn(left, bottom, right, top, [&](EntID eid)
+                    {
+                        rv.push_back(eid);
+                    });
+                    return rv;
+                }
+        };
+
+        /*! Get a secondary index.
+         *
+         * Returns this Database's instance of the index type I, creating and
+         * filling it on first use. Added and removed components are applied
+         * to the index as they happen. Components written since the previous
+         * call are applied before returning; like a `Changed<T>` query, this
+         * only visits pages that were written, and only sees writes that are
+         * recorded for such queries.
+         *
+         * I must be default-constructible, and have:
+         *
+         * - `Component`, the non-tag component type it indexes.
+         * - `void set(EntID, Component const&)`, which adds an Entity or
+         *   updates it.
+         * - `void erase(EntID)`, which removes an Entity that was set.
+         *
+         * HashIndex and GridIndex are provided.
+         *
+         * @warning
+         * Only recorded writes reach the index; see markChanged(). A write
+         * through a reference kept from an earlier access leaves the index
+         * stale without any diagnostic, unless it is marked.
+         *
+         * @warning
+         * Must not be called while other threads use the Database.
+         *
+         * @tparam I Index type.
+         * @return The index.
+         */
+        template <typename I>
+        I const& index()
+        {
+            static_assert(!IsTag<typename I::Component>::value,
+                "Ginseng: Tags cannot be indexed.");
+
+            auto id = getIndexID<I>();
+
+            if (indexes.size() <= id)
+                indexes.resize(id + 1);
+
+            auto& slot = indexes[id];
+
+            if (!slot)
+            {
+                using T = typename I::Component;
+
+                auto ptr = make_unique<IndexHolder<I>>();
+                auto holder = ptr.get();
+                holder->cache = &getCache<typename IndexHolder<I>::Cache>(
+                    getQueryID<IndexHolder<I>>());
+
+                addObserver<T>(&ObserverSet::removed, [holder](EntID eid, T&)
+                {
+                    holder->erase(eid);
+                });
+
+                slot = move(ptr);
+            }
+
+            auto& holder = static_cast<IndexHolder<I>&>(*slot);
+            holder.sync(*entities);
+
+            return holder.index;
+        }
+
+    private:
+
+        // Index helpers
+
+            template <typename I>
+            struct IndexHolder : IndexBase
+            {
+                using T = typename I::Component;
+
+                // Only used for its change tracking.
+                using Cache = QueryCache<Changed<T>, T const>;
+
+                I index;
+                Cache const* cache = nullptr;
+
+                // Entities in the index, by slot.
+                vector<EntID> members;
+
+                void set(EntID eid, T const& com)
+                {
+                    if (members.size() <= eid.index)
+                        members.resize(eid.index + 1);
+
+                    auto& member = members[eid.index];
+
+                    if (member.table && !(member == eid))
+                        index.erase(member);
+
+                    index.set(eid, com);
+                    member = eid;
+                }
+
+                void erase(EntID eid)
+                {
+                    if (eid.index < members.size()
+                        && members[eid.index] == eid)
+                    {
+                        index.erase(eid);
+                        members[eid.index] = EntID();
+                    }
+                }
+
+                // Applies the components written since the last sync.
+                void sync(EntityTable const& table)
+                {
+                    auto v = cache->beginRun(table);
+                    auto fn = [this](EntID eid, T const& com)
+                    {
+                        set(eid, com);
+                    };
+
+                    for (auto const& m : cache->matches)
+                        for (size_type c=0, e=chunksIn(*m.arch); c<e; ++c)
+                            forEachIn(*cache, m, c, v, fn,
+                                      typename Cache::Coms{},
+                                      typename Cache::Indices{});
+                }
+
+                void prune(Database const& db) override
+                {
+                    auto guid = getGUID<T>();
+
+                    for (auto& member : members)
+                    {
+                        if (member.table && (!db.isValid(member)
+                            || !db.entities->slots[member.index]
+                                .archetype->has(guid)))
+                        {
+                            index.erase(member);
+                            member = EntID();
+                        }
+                    }
+                }
+            };
+
+            // Called when Entities may have left without notifying observers.
+            void pruneIndexes()
+            {
+                for (auto const& holder : indexes)
+                    if (holder)
+                        holder->prune(*this);
+            }
+
+    public:
+
+    // Maintenance
+
+        /*! Incrementally sort storage by a key.
+         *
+         * Moves the rows of archetypes with a T so that, within each
+         * archetype, they approach ascending order of `key(com)`. Each call
+         * sorts about budget rows, in windows that alternate between two
+         * offsets, and resumes where the previous call stopped; repeated
+         * calls converge on a fully sorted order and then keep it sorted as
+         * keys drift. Queries then visit Entities in key order.
+         *
+         * Sorting by mortonCode() of a position keeps spatial neighbours
+         * close together in memory.
+         *
+         * EntIDs and version stamps are preserved, and no observers are
+         * notified, since no component is added, removed or changed.
+         *
+         * @warning
+         * All references to components of affected archetypes are
+         * invalidated.
+         *
+         * @tparam T Component type to sort by. Must not be a tag.
+         * @param key Callable as `key(T const&)`, returning a value ordered
+         * by `operator<`.
+         * @param budget Number of rows to sort. At least 2.
+         * @return Number of rows that were moved.
+         */
+        template <typename T, typename KeyFn>
+        size_type reorder(KeyFn&& key, size_type budget)
+        {
+            static_assert(!IsTag<T>::value,
+                "Ginseng: Tags have no storage to reorder.");
+
+            using Key = decay_t<decltype(key(declval<T const&>()))>;
+
+            auto const& cache = getQueryCache<T const>();
+            auto guid = getGUID<T>();
+
+            if (reorders.size() <= size_type(guid))
+                reorders.resize(guid + 1);
+
+            auto& state = reorders[guid];
+            auto window = max(budget, size_type(2));
+            size_type moved = 0;
+            size_type visited = 0;
+            size_type skipped = 0;
+            vector<pair<Key, size_type>> order;
+            vector<max_align_t> scratch;
+
+            while (visited < budget && !cache.matches.empty())
+            {
+                if (state.match >= cache.matches.size())
+                {
+                    state.match = 0;
+                    state.shifted = !state.shifted;
+                    state.row = (state.shifted ? window / 2 : 0);
+                }
+
+                auto& arch = *archetypes[cache.matches[state.match].arch->id];
+
+                if (state.row >= arch.size())
+                {
+                    ++state.match;
+                    state.row = (state.shifted ? window / 2 : 0);
+
+                    // Both offsets of every archetype had nothing to sort.
+                    if (++skipped > 2 * cache.matches.size())
+                        break;
+
+                    continue;
+                }
+
+                skipped = 0;
+
+                auto first = state.row;
+                auto last = min(arch.size(), first + window);
+                auto col = arch.findColumn(guid);
+
+                order.clear();
+
+                for (auto row = first; row < last; ++row)
+                    order.emplace_back(
+                        key(*static_cast<T const*>(col->at(row))), row);
+
+                stable_sort(begin(order), end(order),
+                    [](pair<Key, size_type> const& a,
+                       pair<Key, size_type> const& b)
+                    {
+                        return a.first < b.first;
+                    });
+
+                size_type largest = 0;
+
+                for (auto const& c : arch.columns)
+                    largest = max(largest, c.getInfo().size);
+
+                scratch.resize(
+                    (largest + sizeof(max_align_t) - 1) / sizeof(max_align_t));
+
+                // Row first+i receives order[i]; earlier swaps are followed.
+                for (size_type i = 0; i < order.size(); ++i)
                 {
-                    return (iter == other.iter);
+                    auto src = order[i].second - first;
+
+                    while (src < i)
+                        src = order[src].second - first;
+
+                    if (src != i)
+                    {
+                        arch.swapRows(first + i, first + src, scratch.data());
+                        ++moved;
+                    }
                 }
 
-                /*! Compares this EntID to another for ordering.
-                 *
-                 * Provides a strict weak ordering for EntIDs.
-                 *
-                 * @param other The EntID to compare to this.
-                 * @return True if this should be ordered before other.
-                 */
-                bool operator<(EntID const& other) const
-                {
-                    return (&*iter < &*other.iter);
-                }
+                visited += last - first;
+                state.row = last;
+            }
+
+            return moved;
+        }
+
+        /*! Release unused memory.
+         *
+         * Frees the spare chunk that each archetype keeps after Entities
+         * leave it, trims excess capacity from columns, the entity table and
+         * tag sets, and asks the component allocator to release the boxes it
+         * no longer uses, if it has a `trim()` member.
+         *
+         * Rows are always kept dense, so no component moves, and references
+         * to components remain valid. Pages shared with snapshots are only
+         * freed once the snapshots are gone.
+         *
+         * @return Bytes released, including by the allocator.
+         */
+        size_type compact()
+        {
+            auto before = memoryStats().bytes;
+            auto& table = *entities;
+
+            for (auto& arch : archetypes)
+                arch->compact();
+
+            table.slots.shrink_to_fit();
+
+            for (auto& set : table.tags)
+            {
+                index_type used = 0;
+
+                for (auto slot : set.members)
+                    used = max(used, slot + 1);
+
+                set.members.shrink_to_fit();
+                set.positions.resize(min<size_type>(set.positions.size(),
+                                                    used));
+                set.positions.shrink_to_fit();
+            }
+
+            size_type released = 0;
+
+            for (size_type guid=0; guid<registeredTypes(); ++guid)
+                if (auto info = findTypeInfo(guid))
+                    released += info->trimBoxes();
+
+            return released + (before - memoryStats().bytes);
+        }
+
+    // Memory
+
+        /*! Memory Use of a Component Type
+         *
+         * Tags count their members, and the bytes of their member lists.
+         */
+        struct ComponentStats
+        {
+            // Live components.
+            size_type count = 0;
+
+            // Components that fit in allocated storage.
+            size_type capacity = 0;
+
+            // Bytes of storage and bookkeeping.
+            size_type bytes = 0;
+
+            /*! Fraction of storage not in use.
+             *
+             * @return Between 0 and 1.
+             */
+            double fragmentation() const
+            {
+                return (capacity ? 1.0 - double(count) / capacity : 0.0);
+            }
+        };
+
+        /*! Memory Use of a Database
+         *
+         * Component pages shared with snapshots are counted in full, as are
+         * pages mapped from a save file. Boxed components held outside the
+         * Database, by CommandBuffers or displaced Entities, are not counted.
+         */
+        struct MemoryStats
+        {
+            // By GUID.
+            vector<ComponentStats> components;
+
+            // Live Entities, and slots in the entity table.
+            size_type entities = 0;
+            size_type slots = 0;
+
+            // Bytes of the entity table and of the archetypes' row lists.
+            size_type overhead = 0;
+
+            // Bytes in all, overhead included.
+            size_type bytes = 0;
         };
 
-        /*! Component ID
+        /*! Measure memory use.
          *
-         * A handle to a type-erased component. Very lightweight.
+         * Takes time proportional to the number of archetype columns and
+         * tags.
+         *
+         * @return Memory use of every component type.
          */
-        class ComID
+        MemoryStats memoryStats() const
         {
-            friend class Database;
+            MemoryStats rv;
+            auto const& table = *entities;
 
-            EntID eid;
-            Entity::ComponentVec::const_iterator iter;
+            rv.components.resize(registeredTypes());
+            rv.slots = table.slots.size();
+            rv.overhead = table.slots.capacity() * sizeof(EntityData)
+                + table.population.capacity() * sizeof(size_type);
 
-            public:
+            for (auto const& arch : archetypes)
+            {
+                rv.entities += arch->size();
+                rv.overhead += arch->entities.capacity() * sizeof(index_type);
 
-                /*! Access component data.
-                 *
-                 * Reverses type erasure on the component's data.
-                 * The specified type must match the component's real type,
-                 * otherwise behaviour is undefined.
-                 *
-                 * @tparam Explicit component data type.
-                 * @return Reference to component data.
-                 */
-                template <typename T>
-                T& cast() const
+                for (auto const& col : arch->columns)
                 {
-                    auto& sptr = iter->getVal();
-                    auto ptr = static_cast<Component<T>*>(sptr.get());
-                    return ptr->getVal();
+                    auto& stats = rv.components[col.getGUID()];
+                    stats.count += col.getCount();
+                    stats.capacity += col.capacity();
+                    stats.bytes += col.memoryBytes();
                 }
+            }
 
-                /*! Get parent's EntID.
-                 *
-                 * Returns a handle to the parent Entity.
-                 *
-                 * @return Handle to parent Entity.
-                 */
-                EntID const& getEID() const
-                {
-                    return eid;
-                }
+            for (size_type guid=0; guid<table.tags.size(); ++guid)
+            {
+                if (guid >= rv.components.size() || !isTag(guid))
+                    continue;
+
+                auto const& set = table.tags[guid];
+                auto& stats = rv.components[guid];
+                stats.count = set.members.size();
+                stats.capacity = set.members.capacity();
+                stats.bytes = (set.members.capacity()
+                    + set.positions.capacity()) * sizeof(index_type);
+            }
 
-                /*! Compares this ComID to another for equivalence.
-                 *
-                 * Returns true only if the two ComIDs are handles to the same
-                 * Component.
-                 *
-                 * @param other The ComID to compare to this.
-                 * @return True if ComIDs are equivalent.
-                 */
-                bool operator==(ComID const& other) const
-                {
-                    return (iter == other.iter);
-                }
+            rv.bytes = rv.overhead;
 
-                /*! Compares this ComID to another for ordering.
-                 *
-                 * Provides a strict weak ordering for ComIDs.
-                 *
-                 * @param other The ComID to compare to this.
-                 * @return True if this should be ordered before other.
-                 */
-                bool operator<(ComID const& other) const
-                {
-                    return less<decltype(&*iter)>{}(&*iter,&*other.iter);
-                }
-        };
+            for (auto const& stats : rv.components)
+                rv.bytes += stats.bytes;
 
-        /*! Component Info
+            return rv;
+        }
+
+        /*! Measure memory use of a component type.
          *
-         * A handle to a component of known type.
-         * Provides direct access to the component,
-         * as well as its ComID.
+         * @tparam T Component type.
+         * @return Memory use of T.
+         */
+        template <typename T>
+        ComponentStats componentStats() const
+        {
+            auto guid = getGUID<T>();
+            auto stats = memoryStats();
+
+            return (size_type(guid) < stats.components.size()
+                ? stats.components[guid]
+                : ComponentStats());
+        }
+
+    // Snapshots
+
+        /*! World Snapshot
          *
-         * @tparam Com Component type.
+         * Every Entity and component of a Database at one point in time, as
+         * taken by snapshot() and put back by restore().
+         *
+         * Component pages are shared copy-on-write between the Database and
+         * its snapshots. Taking a snapshot copies no components; afterwards,
+         * the Database copies a page the first time it writes to it. A
+         * history of snapshots thus costs memory in proportion to the pages
+         * written between them. The entity table and tag sets are small, and
+         * are copied outright.
+         *
+         * Snapshots are move-only, and must not outlive their Database.
          */
-        template <typename Com>
-        class ComInfo
+        class Snapshot
         {
             friend class Database;
 
-            Com* ptr = nullptr;
-            ComID cid;
+            EntityTable const* table = nullptr;
+            vector<EntityData> slots;
+            index_type freeHead = NO_INDEX;
+            vector<TagSet> tags;
+            vector<size_type> population;
 
-            ComInfo(Com* p, ComID i)
-                : ptr(p)
-                , cid(i)
-            {}
+            // By archetype id.
+            vector<typename Archetype::State> archetypes;
 
             public:
 
-                using type = Com;
-
-                ComInfo() = default;
+                Snapshot() = default;
+                Snapshot(Snapshot const&) = delete;
+                Snapshot(Snapshot &&) = default;
+                Snapshot& operator=(Snapshot const&) = delete;
+                Snapshot& operator=(Snapshot &&) = default;
 
                 /*! Test for validity.
                  *
-                 * True if this ComInfo points to a component.
-                 * False otherwise.
-                 *
-                 * @return True if valid.
+                 * @return True if this holds a snapshot.
                  */
                 explicit operator bool() const
                 {
-                    return ptr;
-                }
-
-                /*! Get component.
-                 *
-                 * @warning
-                 * Behaviour is undefined if this ComInfo is invalid.
-                 *
-                 * @return The component.
-                 */
-                Com& data() const
-                {
-                    return *ptr;
-                }
-
-                /*! Get component ID.
-                 *
-                 * @warning
-                 * Behaviour is undefined if this ComInfo is invalid.
-                 *
-                 * @return A ComID handle for this component.
-                 */
-                ComID const& id() const
-                {
-                    return cid;
+                    return table;
                 }
         };
 
-    // Entity functions
-
-        /*! Creates a new Entity.
+        /*! Take a snapshot of the Database.
          *
-         * Creates a new Entity that has no components.
+         * Takes time proportional to the number of Entities and component
+         * pages, but copies no components.
          *
-         * @return EntID of the new Entity.
+         * @warning
+         * Every stored component must be copy-constructible, since written
+         * pages are copied. Tags are exempt.
+         *
+         * @return Snapshot of the current state.
          */
-        EntID makeEntity()
+        Snapshot snapshot() const
         {
-            EntID rv;
-            rv.iter = entities.emplace(end(entities));
+            for (auto const& arch : archetypes)
+                if (arch->size() != 0)
+                    checkCopyable(*arch);
+
+            Snapshot rv;
+            rv.table = entities.get();
+            rv.slots = entities->slots;
+            rv.freeHead = entities->freeHead;
+            rv.tags = entities->tags;
+            rv.population = entities->population;
+            rv.archetypes.reserve(archetypes.size());
+
+            for (auto const& arch : archetypes)
+                rv.archetypes.push_back(arch->share());
+
             return rv;
         }
 
-        /*! Destroys an Entity.
+        /*! Restore a snapshot.
          *
-         * Destroys the given Entity and all associated components.
+         * Returns every Entity and component to its state when the snapshot
+         * was taken. EntIDs from that time are valid again, and EntIDs made
+         * since are not. Slots that are free in the snapshot keep their
+         * newer generations, so those EntIDs stay invalid when the slots are
+         * reused. The snapshot is left intact, so it may be restored any
+         * number of times.
+         *
+         * Only component pages that differ from the snapshot are touched;
+         * their rows count as changed for Changed<> queries. Observers are
+         * not notified, but secondary indexes are kept up to date.
          *
          * @warning
-         * All components associated with the Entity are destroyed.
-         * This means that all references and ComIDs associated with those
-         * components are invalidated.
+         * All references to components are invalidated.
          *
-         * @param eid EntID of the Entity to erase.
+         * @param snap Snapshot taken from this Database.
          */
-        void eraseEntity(EntID eid)
+        void restore(Snapshot const& snap)
         {
-            entities.erase(eid.iter);
+            if (snap.table != entities.get())
+                throw invalid_argument(
+                    "Ginseng: Snapshot is from another Database!");
+
+            auto& table = *entities;
+            Version v = table.version;
+            auto populated = table.population.size();
+            auto newer = move(table.slots);
+
+            table.slots = snap.slots;
+            table.freeHead = snap.freeHead;
+            retireHandles(newer);
+            table.tags = snap.tags;
+            table.population = snap.population;
+            table.population.resize(populated, 0);
+
+            typename Archetype::State empty;
+
+            for (size_type i=0; i<archetypes.size(); ++i)
+            {
+                auto& arch = *archetypes[i];
+
+                if (i < snap.archetypes.size())
+                    arch.restore(snap.archetypes[i], v);
+                else
+                    arch.restore(empty, v);
+            }
+
+            pruneIndexes();
         }
 
-        /*! Emplace an Entity into this Database.
+    // Double buffering
+
+        /*! Front Buffer
          *
-         * Move the given Entity into this Database.
+         * A read-only copy of a few component types, for one thread to read
+         * while another goes on writing the Database. publish() swaps the
+         * Database's current state into it, typically once per frame: the
+         * Database is then the back buffer, and the front buffer holds the
+         * last frame.
          *
-         * @param ent Entity rvalue to move.
-         * @return EntID to the new Entity.
-         */
-        EntID emplaceEntity(Entity&& ent)
-        {
-            EntID rv;
-            rv.iter = entities.emplace(end(entities), move(ent));
-            return rv;
-        }
-
-        /*! Displace an Entity out of this Database.
+         * Like a Snapshot, it shares component pages copy-on-write, so
+         * publishing copies no components, and the Database copies a page
+         * the first time it writes to it afterwards. Page reference counts
+         * are atomic and nothing else is shared, so reading a front buffer
+         * takes no locks.
          *
-         * Moves the given Entity out of this Database.
+         * Only Entities that have every one of Ts are kept.
          *
-         * @warning
-         * All EntIDs associated with the Entity are invalidated.
+         * Front buffers are move-only, and must not outlive their Database.
          *
-         * @param eid EntID to Entity to displace.
-         * @return Entity value.
+         * @tparam Ts Component types, which must not be tags.
          */
-        Entity displaceEntity(EntID eid)
+        template <typename... Ts>
+        class FrontBuffer
         {
-            Entity rv = move(*eid.iter);
-            entities.erase(eid.iter);
-            return rv;
-        }
+            friend class Database;
 
-    // Component functions
+            static_assert(is_same<TypeListFilter_t<TypeList<Ts...>, IsTag>,
+                                  TypeList<>>::value,
+                "Ginseng: Tags cannot be double-buffered.");
 
-        /*! Create new component.
+            // The rows of one archetype, and its Ts columns in order.
+            struct Part
+            {
+                vector<index_type> entities;
+                vector<Column> columns;
+            };
+
+            // Where each Entity's row is, by slot.
+            struct Location
+            {
+                index_type part;
+                index_type row;
+                index_type generation;
+            };
+
+            EntityTable const* table = nullptr;
+            vector<Part> parts;
+            vector<Location> locations;
+            size_type count = 0;
+
+            // The entity table itself may be changing, so generations are
+            // read from locations.
+            template <typename Func, size_t... Is>
+            void visit(Part const& part, Func& func, IndexList<Is...>) const
+            {
+                EntID eid;
+                eid.table = table;
+
+                for (size_type row=0; row<part.entities.size(); ++row)
+                {
+                    eid.index = part.entities[row];
+                    eid.generation = locations[eid.index].generation;
+                    func(eid, *static_cast<Ts const*>(
+                        part.columns[Is].at(row))...);
+                }
+            }
+
+            public:
+
+                FrontBuffer() = default;
+                FrontBuffer(FrontBuffer const&) = delete;
+                FrontBuffer(FrontBuffer &&) = default;
+                FrontBuffer& operator=(FrontBuffer const&) = delete;
+                FrontBuffer& operator=(FrontBuffer &&) = default;
+
+                /*! Test for validity.
+                 *
+                 * @return True if anything was published to this buffer.
+                 */
+                explicit operator bool() const
+                {
+                    return table;
+                }
+
+                /*! Get the number of Entities.
+                 *
+                 * @return Number of Entities in the buffer.
+                 */
+                size_type size() const
+                {
+                    return count;
+                }
+
+                /*! Visit every Entity.
+                 *
+                 * Entities are visited in storage order.
+                 *
+                 * @warning
+                 * The EntIDs are only for identification; the Database
+                 * they refer to may be changing on another thread.
+                 *
+                 * @param func Callable as `func(EntID, Ts const&...)`.
+                 */
+                template <typename Func>
+                void for_each(Func&& func) const
+                {
+                    for (auto const& part : parts)
+                        visit(part, func, MakeIndexList_t<sizeof...(Ts)>{});
+                }
+
+                /*! Get an Entity's component.
+                 *
+                 * @tparam T One of Ts.
+                 * @param eid Entity, as of the last publish().
+                 * @return The component, or null if the Entity was not in
+                 * the buffer.
+                 */
+                template <typename T>
+                T const* get(EntID eid) const
+                {
+                    constexpr auto i = ComponentIndex<
+                        typename remove_cv<T>::type, Components<Ts...>>::value;
+
+                    static_assert(i >= 0,
+                        "Ginseng: Component is not in the FrontBuffer.");
+
+                    if (eid.table != table || eid.index >= locations.size())
+                        return nullptr;
+
+                    auto const& loc = locations[eid.index];
+
+                    if (loc.part == NO_INDEX
+                        || loc.generation != eid.generation)
+                    {
+                        return nullptr;
+                    }
+
+                    return static_cast<T const*>(
+                        parts[loc.part].columns[i].at(loc.row));
+                }
+
+                /*! Empty the buffer.
+                 *
+                 * Releases every shared page, so that the Database no longer
+                 * has to copy them before writing.
+                 */
+                void clear()
+                {
+                    parts.clear();
+                    locations.clear();
+                    count = 0;
+                }
+        };
+
+        /*! Publish to a front buffer.
          *
-         * Creates a new component from the given value and associates it with
-         * the given Entity.
-         * If a component of the same type already exists, it will be
-         * overwritten.
+         * Replaces the contents of front with the current state of its
+         * component types. Takes time proportional to the number of
+         * Entities, but copies no components.
+         *
+         * This is the frame boundary: it must not run while anything else
+         * uses the Database, but once it returns, front may be read on
+         * another thread while the Database is written.
          *
          * @warning
-         * All ComIDs associated with components of the given Entity will be
-         * invalidated.
+         * Ts must be copy-constructible, since shared pages are copied
+         * before they are written.
          *
-         * @param eid Entity to attach new component to.
-         * @param com Component value.
-         * @return ComInfo for the new component.
+         * @param front Buffer to replace.
          */
-        template <typename T>
-        ComInfo<T> makeComponent(EntID eid, T com)
+        template <typename... Ts>
+        void publish(FrontBuffer<Ts...>& front) const
         {
-            ComID cid;
-            GUID guid = getGUID<T>();
-            AllocatorT<Component<T>> alloc;
-            auto entIter = make_mutable_iterator(entities, eid.iter);
-            auto& comvec = entIter->components;
+            using Buffer = FrontBuffer<Ts...>;
+
+            array<GUID, sizeof...(Ts)> guids = {{getGUID<Ts>()...}};
+            auto const& table = *entities;
+
+            front.clear();
+            front.table = &table;
+            front.locations.assign(table.slots.size(),
+                                   {NO_INDEX, 0, 0});
+
+            for (auto const& arch : archetypes)
+            {
+                if (arch->size() == 0)
+                    continue;
+
+                typename Buffer::Part part;
+                part.columns.reserve(guids.size());
+
+                for (auto guid : guids)
+                {
+                    auto col = arch->findColumn(guid);
+
+                    if (!col)
+                        break;
 
-            auto pos = lower_bound(begin(comvec), end(comvec), guid);
+                    if (!col->getInfo().copy)
+                        throw logic_error(
+                            "Ginseng: Component is not copyable!");
 
-            cid.eid = eid;
+                    part.columns.push_back(col->share());
+                }
 
-            if (pos != end(comvec) && pos->getGUID() == guid)
-            {
-                cid.iter = pos;
-                cid.template cast<T>() = move(com);
-            }
-            else
-            {
-                auto ptr = allocate_shared<Component<T>>(alloc, move(com));
-                cid.iter = comvec.emplace(pos, guid, move(ptr));
-            }
+                if (part.columns.size() != guids.size())
+                    continue;
 
-            T* comptr = &cid.template cast<T>();
+                auto p = index_type(front.parts.size());
+                part.entities = arch->entities;
 
-            return {comptr,cid};
+                for (size_type row=0; row<part.entities.size(); ++row)
+                {
+                    auto slot = part.entities[row];
+                    front.locations[slot] = {p, index_type(row),
+                                             table.slots[slot].generation};
+                }
+
+                front.count += part.entities.size();
+                front.parts.push_back(move(part));
+            }
         }
 
-        /*! Erase a component.
+    // Serialization
+
+        /*! Register a custom serializer.
          *
-         * Destroys the given component and disassociates it from its Entity.
+         * Components are saved as raw bytes if they are trivially copyable.
+         * Any other component type needs a serializer to be saved, and a
+         * serializer also takes precedence over raw bytes, e.g. for
+         * components that hold pointers.
          *
-         * @warning
-         * All ComIDs associated with components of the component's Entity will
-         * be invalidated.
+         * The Database that loads a file must have the same serializers as
+         * the one that saved it.
          *
-         * @param cid ComID of the component to erase.
+         * @tparam T Component type.
+         * @param save Callable as `save(Writer&, T const&)`.
+         * @param load Callable as `load(Reader&)`, returning a T.
          */
-        void eraseComponent(ComID cid)
+        template <typename T, typename SaveFn, typename LoadFn>
+        void serializer(SaveFn save, LoadFn load)
         {
-            auto iter = make_mutable_iterator(entities,cid.eid.iter);
-            auto& comvec = iter->components;
-            comvec.erase(cid.iter);
+            static_assert(!IsTag<T>::value,
+                "Ginseng: Tags have no state to serialize.");
+
+            auto guid = getGUID<T>();
+
+            if (serializers.size() <= size_type(guid))
+                serializers.resize(guid + 1);
+
+            auto& entry = serializers[guid];
+
+            entry.save = [save](Writer& out, void const* ptr)
+            {
+                save(out, *static_cast<T const*>(ptr));
+            };
+
+            entry.load = [load](Reader& in, void* ptr)
+            {
+                ::new (ptr) T(load(in));
+            };
         }
 
-        /*! Emplace component data into this Database.
+        /*! Save every Entity and component to a file.
          *
-         * Moves the given component data into this Database and associates it
-         * with the given Entity.
+         * Trivially copyable components are written a whole column page at a
+         * time, in the layout load() maps them back in with. Only components
+         * and tags in the ComponentList can be saved, since other types have
+         * no GUID that is stable between runs.
          *
-         * @warning
-         * All ComIDs of components associated with the given Entity are
-         * invalidated.
+         * The file is written beside path, with ".tmp" appended, and then
+         * moved over path. Pages loaded from an earlier file thus keep their
+         * contents, and a world may be saved over the file it was loaded
+         * from.
          *
-         * @param eid Entity to attach component to.
-         * @param dat Component data to move.
-         * @return ComID to the new component.
+         * @param path Path of the file to write.
+         * @throws logic_error if a component cannot be saved.
+         * @throws runtime_error if the file cannot be written or replaced.
          */
-        ComID emplaceComponent(EntID eid, Entity::ComponentData&& dat)
+        void save(string const& path) const
         {
-            ComID rv;
-            auto& comvec = eid.iter->components;
-            GUID guid = dat.getGUID();
+            auto const& table = *entities;
+            vector<index_type> savedIndex (archetypes.size(), NO_INDEX);
+            uint32_t savedArchetypes = 0;
+            uint32_t savedTags = 0;
+
+            for (auto const& arch : archetypes)
+            {
+                if (arch->size() == 0)
+                    continue;
 
-            auto pos = lower_bound(begin(comvec), end(comvec), dat);
+                for (auto const& col : arch->columns)
+                    checkSavable(col.getInfo());
 
-            rv.eid = eid;
+                savedIndex[arch->id] = savedArchetypes++;
+            }
 
-            if (pos != end(comvec) && pos->getGUID() == guid)
+            for (size_type guid=0; guid<table.tags.size(); ++guid)
             {
-                rv.iter = pos;
-                pos->getVal() = move(dat.getVal());
+                if (table.tags[guid].members.empty())
+                    continue;
+
+                checkSavable(*findTypeInfo(guid));
+                ++savedTags;
             }
-            else
+
+            auto temp = path + ".tmp";
+
+            unique_ptr<FILE, int(*)(FILE*)> file (
+                fopen(temp.c_str(), "wb"), &fclose);
+
+            if (!file)
+                throw runtime_error("Ginseng: Failed to open " + temp + "!");
+
+            try
+            {
+                writeSave(*file, savedIndex, savedTags, savedArchetypes);
+            }
+            catch (...)
             {
-                rv.iter = comvec.emplace(pos, move(dat));
+                file.reset();
+                std::remove(temp.c_str());
+                throw;
             }
 
-            return rv;
+            if (fclose(file.release()) != 0)
+            {
+                std::remove(temp.c_str());
+                throw runtime_error("Ginseng: Failed to write save file!");
+            }
+
+            if (!replaceFile(temp, path))
+            {
+                std::remove(temp.c_str());
+                throw runtime_error("Ginseng: Failed to replace " + path + "!");
+            }
         }
 
-        /*! Displace a component out of this Database.
+        /*! Load Entities and components from a file written by save().
          *
-         * Moves the given component out of this Database.
+         * The file is mapped copy-on-write, and the pages of raw columns are
+         * adopted in place rather than copied, so loading takes time
+         * proportional to the number of Entities and pages, plus the
+         * components that have custom serializers. The operating system reads
+         * pages of the file as they are first touched.
+         *
+         * Observers are notified of every loaded component.
          *
          * @warning
-         * All ComIDs associated with the Entity associated with the given
-         * component are invalidated.
+         * The Database must not have any Entities.
          *
-         * @param cid ComID of the component to displace.
-         * @return Component data.
+         * @param path Path of the file to read.
+         * @throws runtime_error if the file cannot be read, or does not match
+         * this program's components. The Database is left empty.
          */
-        Entity::ComponentData displaceComponent(ComID cid)
+        void load(string const& path)
         {
-            Entity::ComponentData rv = move(*cid.iter);
-            auto& comvec = cid.eid.iter->components;
-            comvec.erase(cid.iter);
-            return rv;
+            if (!entities->slots.empty())
+                throw logic_error(
+                    "Ginseng: Can only load into an empty Database!");
+
+            auto file = MappedFile::open(path);
+
+            // Adopted pages hold references of their own.
+            struct Release
+            {
+                MappedFile* file;
+
+                ~Release()
+                {
+                    file->release();
+                }
+            } release {file};
+
+            try
+            {
+                loadFrom(*file);
+            }
+            catch (...)
+            {
+                clearAll();
+                throw;
+            }
+
+            if (observers.empty())
+                return;
+
+            auto const& slots = entities->slots;
+
+            for (size_type i=0; i<slots.size(); ++i)
+                if (slots[i].archetype)
+                    notifyAll(&ObserverSet::added, makeEntID(i));
         }
 
-    // query
+    private:
 
-        /*! Query the Database.
-         *
-         * Queries the Database for Entities that match the given template
-         * properties.
-         *
-         * Template properties can be one of the following:
-         *
-         * - A component type.
-         * - A list of component types in `Not<...>`.
-         *
-         * If a property is a component type, only Entities that contain that
-         * component will be returned.
-         *
-         * If a property is a list of component types in `Not<...>`, only
-         * Entities that do not contain those types will be returned.
-         *
-         * A vector of query elements is returned.
-         *
-         * A query element is a tuple containing an EntID and a series of
-         * component elements.
-         *
-         * A component element is a pair of reference-to-component and ComID.
-         *
-         * There will be a component element for each component type given in
-         * the property list.
-         *
-         * For example, if `db.query<X,Y,Not<Z>>()` is called, its return type
-         * will be determined as follows:
-         *
-         * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~{.cpp}
-         * template <typename T> using ComEle = std::pair<T&,ComID>;
-         * using QueryEle = std::tuple<EntID,ComEle<X>,ComEle<Y>>;
-         * using QueryResult = std::vector<QueryEle>;
-         * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-         *
-         * It is important to note that the return type of
-         * `db.query<X,Y,Not<Z>>()` will be the same as the return type of
-         * `db.query<X,Y>()`.
-         *
-         * @tparam Ts Query properties.
-         * @return Query results.
-         */
-        template <typename... Ts>
-        typename QueryTraits<Database, Ts...>::result query() const
-        {
-            using Traits = QueryTraits<Database, Ts...>;
-            using Result = typename Traits::result;
-            using Nots = typename Traits::nots;
-            using Tmp = typename Traits::result_element;
+        // Save file helpers
 
-            Result rv;
-            Tmp tmp;
+            static constexpr uint32_t SAVE_VERSION = 1;
+            static constexpr uint32_t SAVE_BYTE_ORDER = 0x01020304;
 
-            // Checks the eid for negative query properties.
-            auto check_negatives = [](EntID eid)
+            static char const* saveMagic()
             {
-                return QueryHelper_noNots<Nots>::noNots(eid);
-            };
+                return "Ginseng";
+            }
 
-            // Fills tmp with pointers, returns true on success.
-            auto fill_tmp = [&](EntID eid)
+            [[noreturn]] static void badSave()
             {
-                get<0>(tmp) = eid;
-                return Traits::fillInfo(eid,tmp);
-            };
+                throw runtime_error("Ginseng: Save file does not match!");
+            }
 
-            // Convert tmp pointers into references and push it onto rv.
-            auto push_tmp = [&]()
+            Serializer const* findSerializer(GUID guid) const
             {
-                return rv.emplace_back(move(tmp));
-            };
+                if (size_type(guid) < serializers.size()
+                    && serializers[guid].save)
+                {
+                    return &serializers[guid];
+                }
+
+                return nullptr;
+            }
+
+            void checkSavable(TypeInfo const& info) const
+            {
+                if (info.guid >= countListed(ComponentList{}))
+                    throw logic_error(
+                        "Ginseng: Only listed components can be saved!");
+
+                if (!info.tag && !info.trivial && !findSerializer(info.guid))
+                    throw logic_error("Ginseng: Component has no serializer!");
+            }
 
-            // Inspects eid for query match and pushes it onto rv if it matches.
-            auto inspect_and_push = [&](EntID eid)
+            // Writes the body of save(), for the archetypes in savedIndex.
+            void writeSave(FILE& file, vector<index_type> const& savedIndex,
+                           uint32_t savedTags, uint32_t savedArchetypes) const
             {
-                if (check_negatives(eid) && fill_tmp(eid))
+                auto const& table = *entities;
+                Writer out (&file);
+
+                SaveHeader header = {};
+                memcpy(header.magic, saveMagic(), sizeof(header.magic));
+                header.version = SAVE_VERSION;
+                header.byteOrder = SAVE_BYTE_ORDER;
+                header.alignment = alignof(max_align_t);
+                header.freeHead = table.freeHead;
+                header.slots = table.slots.size();
+                header.tags = savedTags;
+                header.archetypes = savedArchetypes;
+                out.value(header);
+                out.pad();
+
+                vector<SavedSlot> slots;
+                slots.reserve(table.slots.size());
+
+                for (auto const& slot : table.slots)
+                    slots.push_back(SavedSlot{
+                        (slot.archetype ? savedIndex[slot.archetype->id]
+                                        : NO_INDEX),
+                        slot.row,
+                        slot.generation});
+
+                out.bytes(slots.data(), slots.size() * sizeof(SavedSlot));
+                out.pad();
+
+                for (size_type guid=0; guid<table.tags.size(); ++guid)
                 {
-                    push_tmp();
+                    auto const& members = table.tags[guid].members;
+
+                    if (members.empty())
+                        continue;
+
+                    out.value(uint32_t(guid));
+                    out.value(uint32_t(0));
+                    out.value(uint64_t(members.size()));
+                    out.bytes(members.data(),
+                              members.size() * sizeof(index_type));
+                    out.pad();
                 }
-            };
 
-            // Query loop
-            for (auto i=begin(entities), e=end(entities); i!=e; ++i)
+                for (auto const& arch : archetypes)
+                {
+                    if (arch->size() == 0)
+                        continue;
+
+                    out.value(uint32_t(arch->columns.size()));
+                    out.value(uint32_t(arch->shift));
+                    out.value(uint64_t(arch->size()));
+
+                    for (auto guid : arch->signature)
+                        out.value(uint32_t(guid));
+
+                    out.bytes(arch->entities.data(),
+                              arch->size() * sizeof(index_type));
+                    out.pad();
+
+                    for (auto const& col : arch->columns)
+                        saveColumn(out, col);
+                }
+            }
+
+            void saveColumn(Writer& out, Column const& col) const
             {
-                EntID eid;
-                eid.iter = i;
-                inspect_and_push(eid);
+                auto const& info = col.getInfo();
+                auto custom = findSerializer(info.guid);
+                size_type used = 0;
+
+                while (used < col.pageCount() && col.rowsIn(used) > 0)
+                    ++used;
+
+                SavedColumn header;
+                header.guid = uint32_t(info.guid);
+                header.size = uint32_t(info.size);
+                header.encoding = (custom ? Encoding::CUSTOM : Encoding::RAW);
+                header.pages = uint32_t(custom ? 0 : used);
+                out.value(header);
+
+                if (custom)
+                {
+                    for (size_type row=0; row<col.getCount(); ++row)
+                        custom->save(out, col.at(row));
+
+                    out.pad();
+                    return;
+                }
+
+                vector<unsigned char> zeros (col.pageBytes(), 0);
+
+                for (size_type page=0; page<used; ++page)
+                {
+                    auto bytes = col.rowsIn(page) * info.size;
+
+                    out.bytes(col.at(page * col.pageRows()), bytes);
+                    out.bytes(zeros.data(), col.pageBytes() - bytes);
+                    out.pad();
+                }
             }
 
-            return rv;
-        }
+            void loadColumn(Reader& in, MappedFile& file, Column& col,
+                            size_type rows, Version v)
+            {
+                auto const& info = col.getInfo();
+                auto saved = in.value<SavedColumn>();
+
+                if (saved.guid != uint32_t(info.guid)
+                    || saved.size != uint32_t(info.size))
+                {
+                    badSave();
+                }
+
+                if (saved.encoding == Encoding::CUSTOM)
+                {
+                    if (size_type(info.guid) >= serializers.size()
+                        || !serializers[info.guid].load)
+                    {
+                        throw logic_error(
+                            "Ginseng: Component has no serializer!");
+                    }
+
+                    auto const& load = serializers[info.guid].load;
+
+                    for (size_type row=0; row<rows; ++row)
+                    {
+                        if (col.getCount() == col.pageCount() * col.pageRows())
+                            col.pushPage();
+
+                        load(in, col.at(row));
+                        col.grow();
+                        col.touch(row, v);
+                    }
+
+                    in.pad();
+                    return;
+                }
+
+                auto perPage = col.pageRows();
+
+                if (saved.encoding != Encoding::RAW || !info.trivial
+                    || saved.pages != (rows + perPage - 1) / perPage)
+                {
+                    badSave();
+                }
+
+                for (size_type page=0; page<saved.pages; ++page)
+                {
+                    auto data = in.take(col.pageBytes());
+                    in.pad();
+
+                    col.adoptPage(data, &file,
+                                  min(perPage, rows - page * perPage), v);
+                }
+            }
+
+            void loadFrom(MappedFile& file)
+            {
+                auto listed = countListed(ComponentList{});
+                auto& table = *entities;
+                Version v = table.version;
+
+                Reader in (file.data(), file.data() + file.size());
+                auto header = in.value<SaveHeader>();
+                in.pad();
+
+                if (memcmp(header.magic, saveMagic(), sizeof(header.magic))
+                    || header.version != SAVE_VERSION
+                    || header.byteOrder != SAVE_BYTE_ORDER
+                    || header.alignment != alignof(max_align_t))
+                {
+                    throw runtime_error("Ginseng: Unsupported save file!");
+                }
+
+                if (header.slots >= NO_INDEX)
+                    badSave();
+
+                auto slotCount = size_type(header.slots);
+                auto slots = in.take(slotCount * sizeof(SavedSlot));
+                in.pad();
+
+                for (uint32_t i=0; i<header.tags; ++i)
+                {
+                    auto guid = GUID(in.value<uint32_t>());
+                    in.value<uint32_t>();
+                    auto count = in.value<uint64_t>();
+
+                    if (guid >= listed || !isTag(guid) || count > slotCount)
+                        badSave();
+
+                    auto members = in.take(count * sizeof(index_type));
+                    in.pad();
+
+                    auto& set = table.tagSet(guid);
+                    set.members.resize(count);
+                    memcpy(set.members.data(), members,
+                           count * sizeof(index_type));
+                    set.positions.assign(slotCount, NO_INDEX);
+
+                    for (size_type j=0; j<count; ++j)
+                    {
+                        auto slot = set.members[j];
+
+                        if (slot >= slotCount || set.positions[slot] != NO_INDEX)
+                            badSave();
+
+                        set.positions[slot] = j;
+                    }
+                }
+
+                vector<Archetype*> loaded;
+                vector<GUID> sig;
+                size_type totalRows = 0;
+
+                for (uint32_t i=0; i<header.archetypes; ++i)
+                {
+                    auto columns = in.value<uint32_t>();
+                    auto shift = in.value<uint32_t>();
+                    auto rows = in.value<uint64_t>();
+
+                    if (columns > MAX_COMPONENT_TYPES || rows > slotCount)
+                        badSave();
+
+                    sig.clear();
+
+                    for (uint32_t c=0; c<columns; ++c)
+                    {
+                        auto guid = GUID(in.value<uint32_t>());
+
+                        if (guid >= listed || isTag(guid)
+                            || (!sig.empty() && guid <= sig.back()))
+                        {
+                            badSave();
+                        }
+
+                        sig.push_back(guid);
+                    }
+
+                    auto ents = in.take(rows * sizeof(index_type));
+                    in.pad();
+
+                    auto& arch = getArchetype(sig);
+
+                    if (arch.shift != shift || arch.size() != 0)
+                        badSave();
+
+                    // Chunks reserved ahead of time would come before the
+                    // adopted pages.
+                    arch.trimChunks(0);
+
+                    arch.entities.resize(rows);
+                    memcpy(arch.entities.data(), ents,
+                           rows * sizeof(index_type));
+
+                    for (auto& col : arch.columns)
+                    {
+                        loadColumn(in, file, col, rows, v);
+                        table.population[col.getGUID()] += rows;
+                    }
+
+                    arch.chunks = (rows + (size_type(1) << shift) - 1)
+                        >> shift;
+
+                    loaded.push_back(&arch);
+                    totalRows += rows;
+                }
+
+                table.slots.resize(slotCount);
+                size_type live = 0;
+
+                for (size_type i=0; i<slotCount; ++i)
+                {
+                    SavedSlot saved;
+                    memcpy(&saved, slots + i * sizeof(SavedSlot),
+                           sizeof(SavedSlot));
+
+                    auto& slot = table.slots[i];
+                    slot.archetype = nullptr;
+                    slot.row = saved.row;
+                    slot.generation = saved.generation;
+
+                    if (saved.archetype == NO_INDEX)
+                        continue;
+
+                    if (saved.archetype >= loaded.size())
+                        badSave();
+
+                    auto arch = loaded[saved.archetype];
+
+                    if (saved.row >= arch->size()
+                        || arch->entities[saved.row] != i)
+                    {
+                        badSave();
+                    }
+
+                    slot.archetype = arch;
+                    ++live;
+                }
+
+                if (live != totalRows)
+                    badSave();
+
+                // Only live Entities may have tags.
+                for (auto const& set : table.tags)
+                    for (auto slot : set.members)
+                        if (!table.slots[slot].archetype)
+                            badSave();
+
+                // The free list must link every free slot exactly once.
+                vector<bool> linked (slotCount, false);
+                size_type unused = 0;
+
+                for (auto i = header.freeHead; i != NO_INDEX;
+                     i = table.slots[i].row)
+                {
+                    if (i >= slotCount || table.slots[i].archetype
+                        || linked[i])
+                    {
+                        badSave();
+                    }
+
+                    linked[i] = true;
+                    ++unused;
+                }
+
+                if (live + unused != slotCount)
+                    badSave();
+
+                table.freeHead = header.freeHead;
+            }
+
+            // Empties the Database after a failed load.
+            void clearAll()
+            {
+                auto& table = *entities;
+                typename Archetype::State empty;
+
+                for (auto& arch : archetypes)
+                    arch->restore(empty, table.version);
+
+                table.slots.clear();
+                table.freeHead = NO_INDEX;
+                table.tags.clear();
+                fill(begin(table.population), end(table.population), 0);
+
+                pruneIndexes();
+            }
 };
 
+template <template <typename> class AllocatorT, typename ComponentList>
+constexpr typename Database<AllocatorT, ComponentList>::index_type
+    Database<AllocatorT, ComponentList>::NO_INDEX;
+
+template <template <typename> class AllocatorT, typename ComponentList>
+constexpr typename Database<AllocatorT, ComponentList>::size_type
+    Database<AllocatorT, ComponentList>::CHUNK_BYTES;
+
+template <template <typename> class AllocatorT, typename ComponentList>
+constexpr typename Database<AllocatorT, ComponentList>::size_type
+    Database<AllocatorT, ComponentList>::MAX_CHUNK_SHIFT;
+
+template <template <typename> class AllocatorT, typename ComponentList>
+constexpr uint32_t Database<AllocatorT, ComponentList>::SAVE_VERSION;
+
+template <template <typename> class AllocatorT, typename ComponentList>
+constexpr uint32_t Database<AllocatorT, ComponentList>::SAVE_BYTE_ORDER;
+
+template <template <typename> class AllocatorT, typename ComponentList>
+template <typename T>
+constexpr TypeInfo
+    Database<AllocatorT, ComponentList>::ListedTypeInfo<T>::value;
+
 } // namespace _detail
 
 using _detail::Database;
+using _detail::Components;
 using _detail::Not;
+using _detail::Changed;
+using _detail::Tracker;
+using _detail::mortonCode;
+using _detail::Writer;
+using _detail::Reader;
 
 } // namespace Ginseng
 
@@ -0,0 +1,189 @@
+#ifndef GINSENG_MAPPING_HPP
+#define GINSENG_MAPPING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Ginseng {
+
+namespace _detail {
+
+    using namespace std;
+
+/*! Mapped File
+ *
+ * A whole file mapped into memory, copy-on-write: the mapping may be written
+ * to, but writes stay private to this process and never reach the file.
+ * Pages are read from the file as they are first touched.
+ *
+ * Reference counted by hand, so that Database pages adopted from the mapping
+ * can each keep it alive. open() returns it with one reference.
+ */
+class MappedFile
+{
+    unsigned char* bytes = nullptr;
+    size_t length = 0;
+    atomic<size_t> refs {1};
+
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+    MappedFile() = default;
+
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if (bytes)
+            UnmapViewOfFile(bytes);
+        if (mapping)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+#else
+        if (bytes)
+            munmap(bytes, length);
+#endif
+    }
+
+    public:
+
+        MappedFile(MappedFile const&) = delete;
+        MappedFile& operator=(MappedFile const&) = delete;
+
+        /*! Map a file.
+         *
+         * @param path Path of the file.
+         * @return The mapping, holding one reference.
+         * @throws runtime_error if the file cannot be mapped.
+         */
+        static MappedFile* open(string const& path)
+        {
+            auto rv = new MappedFile();
+
+            auto fail = [&]
+            {
+                delete rv;
+                throw runtime_error("Ginseng: Failed to map " + path + "!");
+            };
+
+#ifdef _WIN32
+            rv->file = CreateFileA(path.c_str(), GENERIC_READ,
+                FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+                FILE_ATTRIBUTE_NORMAL, nullptr);
+
+            LARGE_INTEGER size;
+
+            if (rv->file == INVALID_HANDLE_VALUE
+                || !GetFileSizeEx(rv->file, &size) || size.QuadPart == 0)
+            {
+                fail();
+            }
+
+            rv->length = size_t(size.QuadPart);
+            rv->mapping = CreateFileMappingA(rv->file, nullptr, PAGE_WRITECOPY,
+                                             0, 0, nullptr);
+
+            if (!rv->mapping)
+                fail();
+
+            rv->bytes = static_cast<unsigned char*>(
+                MapViewOfFile(rv->mapping, FILE_MAP_COPY, 0, 0, 0));
+
+            if (!rv->bytes)
+                fail();
+#else
+            int fd = ::open(path.c_str(), O_RDONLY);
+            struct stat st;
+
+            if (fd < 0)
+                fail();
+
+            if (fstat(fd, &st) != 0 || st.st_size == 0)
+            {
+                close(fd);
+                fail();
+            }
+
+            rv->length = size_t(st.st_size);
+
+            auto ptr = mmap(nullptr, rv->length, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE, fd, 0);
+
+            close(fd);
+
+            if (ptr == MAP_FAILED)
+                fail();
+
+            rv->bytes = static_cast<unsigned char*>(ptr);
+#endif
+
+            return rv;
+        }
+
+        void retain()
+        {
+            ++refs;
+        }
+
+        // Unmaps the file once the last reference is released.
+        void release()
+        {
+            if (--refs == 0)
+                delete this;
+        }
+
+        unsigned char* data() const
+        {
+            return bytes;
+        }
+
+        size_t size() const
+        {
+            return length;
+        }
+};
+
+/*! Move a file over another.
+ *
+ * The file being replaced may still be mapped; its mappings keep the old
+ * contents. On Windows this needs the file to have been mapped with delete
+ * sharing, as MappedFile::open() does.
+ *
+ * @param from Path of the file to move.
+ * @param to Path of the file to replace.
+ * @return True on success.
+ */
+inline bool replaceFile(string const& from, string const& to)
+{
+#ifdef _WIN32
+    return MoveFileExA(from.c_str(), to.c_str(),
+                       MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+} // namespace _detail
+
+using _detail::MappedFile;
+
+} // namespace Ginseng
+
+#endif // GINSENG_MAPPING_HPP
@@ -0,0 +1,187 @@
+#ifndef GINSENG_SCHEDULER_HPP
+#define GINSENG_SCHEDULER_HPP
+
+#include "threadpool.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace Ginseng {
+
+namespace _detail {
+
+    using namespace std;
+
+/*! System Scheduler
+ *
+ * Runs a list of systems once per call to run(). Each system declares the
+ * types it accesses: `const T` is a read and `T` is a write. Types are
+ * usually components, but any type may stand in for a shared resource.
+ *
+ * Two systems conflict if either one writes something the other accesses.
+ * A system always runs after every earlier-added system it conflicts with;
+ * systems that do not conflict run concurrently on a ThreadPool.
+ *
+ * Concurrent systems may run Database queries, even for the first time, and
+ * write the components they declare. They must not add or remove Entities
+ * or components; they may queue such changes in CommandBuffers of their own,
+ * to be flushed by an exclusive system. Two concurrent systems must not run
+ * the same Changed<> query, since each run advances the query's state.
+ */
+class Scheduler
+{
+    using Key = void const*;
+
+    template <typename T>
+    struct KeyOf
+    {
+        static char const id;
+    };
+
+    struct System
+    {
+        function<void()> fn;
+        vector<Key> reads;
+        vector<Key> writes;
+        bool exclusive;
+    };
+
+    vector<System> systems;
+
+    // Systems grouped so that each group only depends on earlier groups.
+    vector<vector<size_t>> waves;
+    bool dirty = true;
+
+    template <typename T>
+    static void addAccess(System& sys)
+    {
+        auto key = &KeyOf<typename remove_cv<T>::type>::id;
+
+        if (is_const<T>::value)
+            sys.reads.push_back(key);
+        else
+            sys.writes.push_back(key);
+    }
+
+    static bool intersects(vector<Key> const& a, vector<Key> const& b)
+    {
+        for (auto key : a)
+            if (find(begin(b), end(b), key) != end(b))
+                return true;
+        return false;
+    }
+
+    static bool conflicts(System const& a, System const& b)
+    {
+        return (a.exclusive || b.exclusive
+            || intersects(a.writes, b.writes)
+            || intersects(a.writes, b.reads)
+            || intersects(b.writes, a.reads));
+    }
+
+    void build()
+    {
+        vector<size_t> level (systems.size(), 0);
+
+        waves.clear();
+
+        for (size_t i=0; i<systems.size(); ++i)
+        {
+            for (size_t j=0; j<i; ++j)
+                if (conflicts(systems[j], systems[i]))
+                    level[i] = max(level[i], level[j] + 1);
+
+            if (waves.size() <= level[i])
+                waves.resize(level[i] + 1);
+
+            waves[level[i]].push_back(i);
+        }
+
+        dirty = false;
+    }
+
+    public:
+
+        /*! Add a system.
+         *
+         * @tparam Ts Accessed types; `const T` for reads, `T` for writes.
+         * @param fn Callable as `fn()`.
+         */
+        template <typename... Ts, typename F>
+        void addSystem(F&& fn)
+        {
+            System sys;
+            sys.fn = forward<F>(fn);
+            sys.exclusive = false;
+
+            int expand[] = {0, (addAccess<Ts>(sys), 0)...};
+            (void)expand;
+
+            systems.push_back(move(sys));
+            dirty = true;
+        }
+
+        /*! Add an exclusive system.
+         *
+         * An exclusive system conflicts with every other system, so it may
+         * make structural changes, such as flushing a CommandBuffer.
+         *
+         * @param fn Callable as `fn()`.
+         */
+        template <typename F>
+        void addExclusive(F&& fn)
+        {
+            System sys;
+            sys.fn = forward<F>(fn);
+            sys.exclusive = true;
+
+            systems.push_back(move(sys));
+            dirty = true;
+        }
+
+        /*! Run every system once.
+         *
+         * @param pool Pool to run concurrent systems on.
+         */
+        void run(ThreadPool& pool)
+        {
+            if (dirty)
+                build();
+
+            for (auto const& wave : waves)
+            {
+                if (wave.size() == 1)
+                {
+                    systems[wave[0]].fn();
+                    continue;
+                }
+
+                pool.parallelFor(wave.size(), [&](size_t i)
+                {
+                    systems[wave[i]].fn();
+                });
+            }
+        }
+
+        /*! Run every system once on the defaultThreadPool().
+         */
+        void run()
+        {
+            run(defaultThreadPool());
+        }
+};
+
+template <typename T>
+char const Scheduler::KeyOf<T>::id = 0;
+
+} // namespace _detail
+
+using _detail::Scheduler;
+
+} // namespace Ginseng
+
+#endif // GINSENG_SCHEDULER_HPP
@@ -0,0 +1,294 @@
+#ifndef GINSENG_THREADPOOL_HPP
+#define GINSENG_THREADPOOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Ginseng {
+
+namespace _detail {
+
+    using namespace std;
+
+/*! Thread Pool
+ *
+ * A fixed set of worker threads with one work queue each. Work is handed
+ * out as index ranges; a thread splits the range it is working on and
+ * leaves the other half in its own queue, where idle threads steal it from
+ * the far end.
+ *
+ * A thread that waits for its work to finish runs queued work in the
+ * meantime, so parallel loops may be nested, and may be started from inside
+ * other parallel loops, without deadlocking.
+ */
+class ThreadPool
+{
+    struct Batch
+    {
+        void (*call)(void* ctx, size_t i);
+        void* ctx;
+        atomic<size_t> remaining;
+        mutex errorMutex;
+        exception_ptr error;
+    };
+
+    struct Range
+    {
+        Batch* batch;
+        size_t first;
+        size_t last;
+    };
+
+    struct Queue
+    {
+        mutex m;
+        deque<Range> ranges;
+    };
+
+    vector<unique_ptr<Queue>> queues;
+    vector<thread> workers;
+
+    mutex sleepMutex;
+    condition_variable wake;
+    atomic<size_t> queued;
+    bool stopping = false;
+
+    struct ThreadState
+    {
+        ThreadPool const* owner = nullptr;
+        size_t index = 0;
+    };
+
+    static ThreadState& threadState()
+    {
+        thread_local ThreadState state;
+        return state;
+    }
+
+    // Index of the calling thread's queue. Threads that are not our workers
+    // share the last queue.
+    size_t selfIndex() const
+    {
+        auto const& state = threadState();
+
+        if (state.owner == this)
+            return state.index;
+
+        return queues.size() - 1;
+    }
+
+    void push(size_t q, Range range)
+    {
+        {
+            lock_guard<mutex> lock (queues[q]->m);
+            queues[q]->ranges.push_back(range);
+        }
+
+        {
+            lock_guard<mutex> lock (sleepMutex);
+            ++queued;
+        }
+
+        wake.notify_one();
+    }
+
+    bool pop(size_t q, Range& range, bool steal)
+    {
+        auto& queue = *queues[q];
+        lock_guard<mutex> lock (queue.m);
+
+        if (queue.ranges.empty())
+            return false;
+
+        if (steal)
+        {
+            range = queue.ranges.front();
+            queue.ranges.pop_front();
+        }
+        else
+        {
+            range = queue.ranges.back();
+            queue.ranges.pop_back();
+        }
+
+        --queued;
+        return true;
+    }
+
+    // Runs one range from our own queue or a stolen one.
+    bool runOne()
+    {
+        auto self = selfIndex();
+        Range range;
+
+        bool found = pop(self, range, false);
+
+        for (size_t i=1; !found && i<queues.size(); ++i)
+            found = pop((self + i) % queues.size(), range, true);
+
+        if (!found)
+            return false;
+
+        while (range.last - range.first > 1)
+        {
+            auto mid = range.first + (range.last - range.first) / 2;
+            push(self, Range{range.batch, mid, range.last});
+            range.last = mid;
+        }
+
+        auto& batch = *range.batch;
+
+        try
+        {
+            batch.call(batch.ctx, range.first);
+        }
+        catch (...)
+        {
+            lock_guard<mutex> lock (batch.errorMutex);
+            if (!batch.error)
+                batch.error = current_exception();
+        }
+
+        --batch.remaining;
+
+        return true;
+    }
+
+    void work(size_t index)
+    {
+        threadState().owner = this;
+        threadState().index = index;
+
+        for (;;)
+        {
+            if (runOne())
+                continue;
+
+            unique_lock<mutex> lock (sleepMutex);
+            wake.wait(lock, [&]{ return stopping || queued > 0; });
+
+            if (stopping)
+                return;
+        }
+    }
+
+    public:
+
+        /*! Create a pool.
+         *
+         * @param threads Number of worker threads. The thread that starts a
+         * parallel loop also takes part, so this may be zero.
+         */
+        explicit ThreadPool(size_t threads)
+            : queued(0)
+        {
+            for (size_t i=0; i<threads+1; ++i)
+                queues.push_back(make_unique<Queue>());
+
+            workers.reserve(threads);
+
+            for (size_t i=0; i<threads; ++i)
+                workers.emplace_back([this, i]{ work(i); });
+        }
+
+        ThreadPool()
+            : ThreadPool(max(thread::hardware_concurrency(), 1U) - 1)
+        {}
+
+        ThreadPool(ThreadPool const&) = delete;
+        ThreadPool& operator=(ThreadPool const&) = delete;
+
+        ~ThreadPool()
+        {
+            {
+                lock_guard<mutex> lock (sleepMutex);
+                stopping = true;
+            }
+
+            wake.notify_all();
+
+            for (auto& worker : workers)
+                worker.join();
+        }
+
+        /*! Get the number of threads.
+         *
+         * @return Number of threads that run work, including the caller.
+         */
+        size_t size() const
+        {
+            return workers.size() + 1;
+        }
+
+        /*! Run a parallel loop.
+         *
+         * Calls `fn(i)` for each `i` in `[0, count)`, spread over the pool,
+         * and returns once every call has finished. If any call throws, the
+         * first exception is rethrown here after the others have finished.
+         *
+         * @param count Number of iterations.
+         * @param fn Callback.
+         */
+        template <typename F>
+        void parallelFor(size_t count, F&& fn)
+        {
+            if (count == 0)
+                return;
+
+            using Fn = typename remove_reference<F>::type;
+
+            Batch batch;
+            batch.call = [](void* ctx, size_t i)
+            {
+                (*static_cast<Fn*>(ctx))(i);
+            };
+            batch.ctx = const_cast<void*>(static_cast<void const*>(&fn));
+            batch.remaining = count;
+
+            // Seed every queue with an even share of the work.
+            auto shares = min(count, queues.size());
+            auto self = selfIndex();
+
+            for (size_t i=0; i<shares; ++i)
+            {
+                auto q = (self + i) % queues.size();
+                push(q, Range{&batch, count*i/shares, count*(i+1)/shares});
+            }
+
+            while (batch.remaining > 0)
+                if (!runOne())
+                    this_thread::yield();
+
+            if (batch.error)
+                rethrow_exception(batch.error);
+        }
+};
+
+/*! Get the default ThreadPool.
+ *
+ * Created on first use, with one thread per hardware thread.
+ *
+ * @return The shared pool.
+ */
+inline ThreadPool& defaultThreadPool()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+} // namespace _detail
+
+using _detail::ThreadPool;
+using _detail::defaultThreadPool;
+
+} // namespace Ginseng
+
+#endif // GINSENG_THREADPOOL_HPP
@@ -39,7 +39,6 @@ Profiler::Profile::Profile()
     , max(std::numeric_limits<double>::min())
     , average(0.0)
     , samples(0.0)
-    , start(0.0)
     , children()
 {}
 
@@ -48,36 +47,45 @@ const Profiler::Profile::PMap& Profiler::Profile::getChildren() const
     return children;
 }
 
+std::vector<Profiler::Active>& Profiler::current()
+{
+    thread_local std::vector<Active> stack;
+    return stack;
+}
+
 void Profiler::start(const std::string& in)
 {
-    if (current.begin() != current.end())
+    auto& stack = current();
+    Profile* p;
+
     {
-        auto p = current.back();
-        auto&& c = p->children[in];
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& pmap = (stack.empty() ? profiles
+                                    : stack.back().profile->children);
+        auto&& c = pmap[in];
         if (!c) c.reset(new Profile);
-        current.push_back(c);
-        c->start = glfwGetTime();
-    }
-    else
-    {
-        auto&& p = profiles[in];
-        if (!p) p.reset(new Profile);
-        current.push_back(p);
-        p->start = glfwGetTime();
+        p = c.get();
     }
+
+    stack.push_back({p, glfwGetTime()});
 }
 
 void Profiler::stop()
 {
-    if (current.begin() != current.end())
+    auto& stack = current();
+
+    if (stack.begin() != stack.end())
     {
-        Profile& p = *current.back();
-        double dur = glfwGetTime() - p.start;
+        auto active = stack.back();
+        double dur = glfwGetTime() - active.start;
+        stack.pop_back();
+
+        Profile& p = *active.profile;
+        std::lock_guard<std::mutex> lock(p.statsMutex);
         if (dur < p.min) p.min = dur;
         if (dur > p.max) p.max = dur;
         p.average = (p.average * p.samples + dur) / (p.samples + 1.0);
         p.samples += 1.0;
-        current.pop_back();
     }
     else
     {
@@ -32,6 +32,7 @@
 
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -41,6 +42,9 @@ namespace Inugami {
  *
  *  This class is an automatic nesting profiler. It can be used for high-
  *  precision timing for use in tracking down bottlenecks.
+ *
+ *  Profiles may be started from several threads at once; each thread nests
+ *  its own Profiles.
  */
 class Profiler
 {
@@ -74,7 +78,7 @@ public:
         const PMap& getChildren() const;
 
     private:
-        double start;
+        std::mutex statsMutex;
         PMap children;
     };
 
@@ -84,8 +88,8 @@ public:
 
     /*! @brief Start the specified Profile.
      *
-     *  Starts the given Profile. If another Profile is already active, the
-     *  given Profile is nested inside of the active Profile.
+     *  Starts the given Profile. If another Profile is already active on the
+     *  calling thread, the given Profile is nested inside of it.
      *
      *  @param in Name of the Profile to start.
      */
@@ -93,8 +97,8 @@ public:
 
     /*! @brief Stops the active Profile.
      *
-     *  Stops the currently active Profile. If the active Profile is nested,
-     *  the parent Profile becomes active.
+     *  Stops the calling thread's active Profile. If the active Profile is
+     *  nested, the parent Profile becomes active.
      */
     void stop();
 
@@ -107,8 +111,18 @@ public:
     const PMap& getAll() const;
 
 private:
+    struct Active
+    {
+        Profile* profile;
+        double start;
+    };
+
+    // The calling thread's started Profiles, innermost last.
+    static std::vector<Active>& current();
+
+    // Guards profiles and every Profile's children.
+    std::mutex mutex;
     PMap profiles;
-    std::vector<Profile::Ptr> current;
 };
 
 } // namespace Inugami
@@ -1,8 +1,14 @@
 #ifndef PUDDLE_PUDDLE_HPP
 #define PUDDLE_PUDDLE_HPP
 
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <new>
 #include <stdexcept>
 #include <type_traits>
 #include <vector>
@@ -40,6 +46,25 @@ class Allocator<T, false>
 
     private:
 
+        /* Global
+         *
+         * The shared pool of Ts. Each thread keeps a Cache of free elements
+         * and only visits the pool to trade whole batches of them, so the
+         * common case touches nothing shared.
+         *
+         * Batches wait in the depot, a lock-free stack. It links Batch
+         * descriptors by index rather than by pointer, so that the top can
+         * carry a tag that changes with every push and pop; a pop that
+         * raced with others then fails its compare-and-swap even if the
+         * same descriptor is back on top. Descriptors are never freed, so
+         * reading one that was popped in the meantime is harmless.
+         *
+         * Blocks are only allocated or freed under the mutex.
+         *
+         * A thread's Cache goes back to the depot when the thread exits. If
+         * no descriptor can be made for it then, its elements are kept in
+         * the orphan list instead, since a destructor must not throw.
+         */
         struct Global
         {
             struct Element
@@ -62,44 +87,390 @@ class Allocator<T, false>
             static constexpr size_type BLK_SIZE = 8U * 1024U;
             static constexpr size_type BLK_ELES = BLK_SIZE/ELE_SIZE;
 
+            // Elements traded with the depot at once.
+            static constexpr size_type BATCH_ELES = 64U;
+
+            // A Cache holding this many flushes a batch.
+            static constexpr size_type CACHE_ELES = 2U * BATCH_ELES;
+
             struct Block
             {
                 Element eles[BLK_ELES];
             };
 
+            struct Batch
+            {
+                Element* head;
+                size_type count;
+                ::std::atomic<::std::uint32_t> next;
+            };
+
+            // Descriptors are allocated in chunks, which are never moved.
+            static constexpr size_type CHUNK_BATCHES = 1024U;
+            static constexpr size_type MAX_CHUNKS = 1024U;
+
+            /* Tagged stack of Batch descriptors.
+             * The low half of top is the index of the top descriptor plus
+             * one, or zero when empty; the high half is the tag.
+             */
+            struct Stack
+            {
+                ::std::atomic<::std::uint64_t> top {0};
+            };
+
+            struct Cache
+            {
+                Element* head = nullptr;
+                size_type count = 0;
+
+                ~Cache()
+                {
+                    getGlobal().release(*this);
+                }
+            };
+
+            ::std::mutex mutex;
             ::std::vector<::std::unique_ptr<Block>> blocks;
-            Element* next = nullptr;
 
-            T* allocate()
+            // Free elements of exited threads, under the mutex.
+            Element* orphans = nullptr;
+            size_type orphanCount = 0;
+
+            ::std::atomic<Batch*> chunks[MAX_CHUNKS] = {};
+            ::std::atomic<::std::uint32_t> batches {0};
+
+            // Batches of free elements.
+            Stack depot;
+
+            // Descriptors not in the depot.
+            Stack spare;
+
+            ~Global()
+            {
+                for (auto& chunk : chunks)
+                    delete[] chunk.load();
+            }
+
+            static Cache& getCache()
+            {
+                static thread_local Cache inst;
+                return inst;
+            }
+
+            Batch& batch(::std::uint32_t i)
+            {
+                auto chunk = chunks[i / CHUNK_BATCHES].load(
+                    ::std::memory_order_acquire);
+                return chunk[i % CHUNK_BATCHES];
+            }
+
+            void push(Stack& stack, ::std::uint32_t i)
+            {
+                auto& b = batch(i);
+                auto top = stack.top.load(::std::memory_order_relaxed);
+
+                for (;;)
+                {
+                    b.next.store(::std::uint32_t(top),
+                                 ::std::memory_order_relaxed);
+
+                    auto tag = (top >> 32) + 1;
+
+                    if (stack.top.compare_exchange_weak(top,
+                            (tag << 32) | (i + 1U),
+                            ::std::memory_order_release,
+                            ::std::memory_order_relaxed))
+                    {
+                        return;
+                    }
+                }
+            }
+
+            bool pop(Stack& stack, ::std::uint32_t& i)
+            {
+                auto top = stack.top.load(::std::memory_order_acquire);
+
+                for (;;)
+                {
+                    auto index = ::std::uint32_t(top);
+
+                    if (index == 0)
+                        return false;
+
+                    auto next = batch(index - 1).next.load(
+                        ::std::memory_order_relaxed);
+                    auto tag = (top >> 32) + 1;
+
+                    if (stack.top.compare_exchange_weak(top,
+                            (tag << 32) | next,
+                            ::std::memory_order_acquire,
+                            ::std::memory_order_acquire))
+                    {
+                        i = index - 1;
+                        return true;
+                    }
+                }
+            }
+
+            // A descriptor from spare, or a new one.
+            ::std::uint32_t makeBatch()
+            {
+                ::std::uint32_t i;
+
+                if (pop(spare, i))
+                    return i;
+
+                i = batches++;
+
+                auto c = i / CHUNK_BATCHES;
+
+                if (c >= MAX_CHUNKS)
+                    throw ::std::bad_alloc();
+
+                if (!chunks[c].load(::std::memory_order_acquire))
+                {
+                    ::std::lock_guard<::std::mutex> lock (mutex);
+
+                    if (!chunks[c].load(::std::memory_order_relaxed))
+                        chunks[c].store(new Batch[CHUNK_BATCHES](),
+                                        ::std::memory_order_release);
+                }
+
+                return i;
+            }
+
+            // Moves up to count elements from the front of cache to the
+            // depot.
+            void flush(Cache& cache, size_type count)
             {
-                if (!next)
+                while (count > 0 && cache.head)
                 {
-                    ::std::unique_ptr<Block> ptr (new Block);
+                    auto i = makeBatch();
+                    auto& b = batch(i);
+                    auto last = cache.head;
+                    auto limit = (count < BATCH_ELES ? count : BATCH_ELES);
 
-                    next = &ptr->eles[0];
+                    b.head = cache.head;
+                    b.count = 1;
 
-                    for (size_type i=0; i<BLK_ELES-1; ++i)
+                    while (b.count < limit && last->next)
                     {
-                        ptr->eles[i].next = &ptr->eles[i+1];
+                        last = last->next;
+                        ++b.count;
                     }
 
-                    ptr->eles[BLK_ELES-1].next = nullptr;
+                    cache.head = last->next;
+                    cache.count -= b.count;
+                    count -= b.count;
+                    last->next = nullptr;
 
+                    push(depot, i);
+                }
+            }
+
+            // Empties a thread's cache when the thread exits.
+            void release(Cache& cache) noexcept
+            {
+                try
+                {
+                    flush(cache, cache.count);
+                }
+                catch (...)
+                {
+                    if (!cache.head)
+                        return;
+
+                    auto last = cache.head;
+
+                    while (last->next)
+                        last = last->next;
+
+                    ::std::lock_guard<::std::mutex> lock (mutex);
+                    last->next = orphans;
+                    orphans = cache.head;
+                    orphanCount += cache.count;
+                    cache.head = nullptr;
+                    cache.count = 0;
+                }
+            }
+
+            // Fills an empty cache from the depot, the orphans, or a new
+            // block.
+            void refill(Cache& cache)
+            {
+                ::std::uint32_t index;
+
+                if (pop(depot, index))
+                {
+                    auto& b = batch(index);
+                    cache.head = b.head;
+                    cache.count = b.count;
+                    push(spare, index);
+                    return;
+                }
+
+                {
+                    ::std::lock_guard<::std::mutex> lock (mutex);
+
+                    if (orphans)
+                    {
+                        cache.head = orphans;
+                        cache.count = orphanCount;
+                        orphans = nullptr;
+                        orphanCount = 0;
+                        return;
+                    }
+                }
+
+                ::std::unique_ptr<Block> ptr (new Block);
+
+                for (size_type i=0; i<BLK_ELES-1; ++i)
+                {
+                    ptr->eles[i].next = &ptr->eles[i+1];
+                }
+
+                ptr->eles[BLK_ELES-1].next = nullptr;
+
+                {
+                    ::std::lock_guard<::std::mutex> lock (mutex);
                     blocks.emplace_back(::std::move(ptr));
+                    cache.head = &blocks.back()->eles[0];
                 }
 
-                T* rv = &next->val;
+                cache.count = BLK_ELES;
+            }
+
+            T* allocate()
+            {
+                auto& cache = getCache();
+
+                if (!cache.head)
+                    refill(cache);
 
-                next = next->next;
+                Element* curr = cache.head;
+                cache.head = curr->next;
+                --cache.count;
 
-                return rv;
+                return &curr->val;
             }
 
             void deallocate(T* t)
             {
+                auto& cache = getCache();
+
                 Element* curr = reinterpret_cast<Element*>(t);
-                curr->next = next;
-                next = curr;
+                curr->next = cache.head;
+                cache.head = curr;
+
+                if (++cache.count >= CACHE_ELES)
+                    flush(cache, BATCH_ELES);
+            }
+
+            // Frees the blocks whose elements are all in the depot.
+            size_type trim()
+            {
+                using BlockPtr = ::std::unique_ptr<Block>;
+
+                flush(getCache(), getCache().count);
+
+                ::std::lock_guard<::std::mutex> lock (mutex);
+
+                Element* next = nullptr;
+                ::std::uint32_t i;
+
+                while (pop(depot, i))
+                {
+                    auto& b = batch(i);
+
+                    for (auto e = b.head; e;)
+                    {
+                        auto following = e->next;
+                        e->next = next;
+                        next = e;
+                        e = following;
+                    }
+
+                    push(spare, i);
+                }
+
+                auto before = [](BlockPtr const& a, BlockPtr const& b)
+                {
+                    return ::std::less<Block*>()(a.get(), b.get());
+                };
+
+                ::std::sort(blocks.begin(), blocks.end(), before);
+
+                auto blockOf = [&](Element* e)
+                {
+                    auto iter = ::std::upper_bound(blocks.begin(), blocks.end(),
+                        e, [](Element* e, BlockPtr const& b)
+                        {
+                            return ::std::less<Element*>()(e, &b->eles[0]);
+                        });
+                    return size_type(iter - blocks.begin() - 1);
+                };
+
+                ::std::vector<size_type> frees (blocks.size(), 0);
+
+                for (auto e = next; e; e = e->next)
+                    ++frees[blockOf(e)];
+
+                for (auto e = orphans; e; e = e->next)
+                    ++frees[blockOf(e)];
+
+                Cache kept;
+
+                for (auto e = next; e;)
+                {
+                    auto following = e->next;
+
+                    if (frees[blockOf(e)] != BLK_ELES)
+                    {
+                        e->next = kept.head;
+                        kept.head = e;
+                        ++kept.count;
+                    }
+
+                    e = following;
+                }
+
+                // Kept orphans stay orphans: the depot's elements fill no
+                // more descriptors than were just popped, so flushing them
+                // never takes the mutex, but orphans might need more.
+                auto orphan = orphans;
+                orphans = nullptr;
+                orphanCount = 0;
+
+                while (orphan)
+                {
+                    auto following = orphan->next;
+
+                    if (frees[blockOf(orphan)] != BLK_ELES)
+                    {
+                        orphan->next = orphans;
+                        orphans = orphan;
+                        ++orphanCount;
+                    }
+
+                    orphan = following;
+                }
+
+                flush(kept, kept.count);
+
+                size_type released = 0;
+                size_type out = 0;
+
+                for (size_type i=0; i<blocks.size(); ++i)
+                {
+                    if (frees[i] == BLK_ELES)
+                        ++released;
+                    else
+                        blocks[out++] = ::std::move(blocks[i]);
+                }
+
+                blocks.resize(out);
+
+                return released * sizeof(Block);
             }
         };
 
@@ -137,6 +508,22 @@ class Allocator<T, false>
             return getGlobal().deallocate(t);
         }
 
+        /*! Release unused memory.
+         *
+         * Frees every block of the shared pool for T whose elements are all
+         * free. Runs in time proportional to the number of free elements.
+         *
+         * @warning
+         * Elements cached by other threads count as in use, and no other
+         * thread may allocate or free Ts meanwhile.
+         *
+         * @return Bytes released.
+         */
+        size_type trim()
+        {
+            return getGlobal().trim();
+        }
+
         template <typename U, typename... Args>
         void construct(U* p, Args&&... args)
         {
@@ -170,6 +557,11 @@ class Allocator<T, true>
 
         void deallocate(T*, size_type)
         {}
+
+        size_type trim()
+        {
+            return 0;
+        }
 };
 
 } // namespace _detail
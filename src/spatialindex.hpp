@@ -0,0 +1,36 @@
+#ifndef SPATIALINDEX_HPP
+#define SPATIALINDEX_HPP
+
+#include "component.position.hpp"
+#include "rect.hpp"
+#include "types.hpp"
+
+#include <utility>
+#include <vector>
+
+struct PositionPoint
+{
+    std::pair<double,double> operator()(Component::Position const& pos) const
+    {
+        return {pos.x, pos.y};
+    }
+};
+
+// Entities by Position, on a grid of 4x4-tile cells.
+class SpatialIndex
+    : public ECDatabase::GridIndex<Component::Position, PositionPoint>
+{
+public:
+    SpatialIndex()
+        : GridIndex(128)
+    {}
+
+    using GridIndex::queryRect;
+
+    std::vector<EntID> queryRect(Rect const& r) const
+    {
+        return queryRect(r.left, r.bottom, r.right, r.top);
+    }
+};
+
+#endif // SPATIALINDEX_HPP
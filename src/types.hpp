@@ -1,13 +1,24 @@
 #ifndef TYPES_HPP
 #define TYPES_HPP
 
+#include "forward.hpp"
+
 #include "ginseng/ginseng.hpp"
 #include "puddle/puddle.hpp"
 
 template <typename T>
 using PoolAllocator = Puddle::Allocator<T>;
 
-using ECDatabase = Ginseng::Database<PoolAllocator>;
+using ECComponents = Ginseng::Components<
+    Component::AI,
+    Component::CamLook,
+    Component::KillMe,
+    Component::Position,
+    Component::Solid,
+    Component::Sprite,
+    Component::Velocity>;
+
+using ECDatabase = Ginseng::Database<PoolAllocator, ECComponents>;
 
 using Ginseng::Not;
 
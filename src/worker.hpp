@@ -0,0 +1,98 @@
+#ifndef WORKER_HPP
+#define WORKER_HPP
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+// One persistent thread that runs a job at a time. Handing it a job only
+// wakes it, so it can run one every frame without creating threads.
+class Worker
+{
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::function<void()> job;
+    std::exception_ptr error;
+    bool busy = false;
+    bool stopping = false;
+    std::thread thread;
+
+    void work()
+    {
+        std::unique_lock<std::mutex> lock (mutex);
+
+        for (;;)
+        {
+            wake.wait(lock, [&]{ return stopping || busy; });
+
+            if (!busy)
+                return;
+
+            lock.unlock();
+
+            try
+            {
+                job();
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+
+            lock.lock();
+            busy = false;
+            wake.notify_all();
+        }
+    }
+
+public:
+
+    Worker()
+        : thread([this]{ work(); })
+    {}
+
+    Worker(Worker const&) = delete;
+    Worker& operator=(Worker const&) = delete;
+
+    // Finishes the current job, if any, before stopping.
+    ~Worker()
+    {
+        {
+            std::lock_guard<std::mutex> lock (mutex);
+            stopping = true;
+        }
+
+        wake.notify_all();
+        thread.join();
+    }
+
+    // Starts fn on the worker, after waiting for the current job.
+    template <typename F>
+    void run(F&& fn)
+    {
+        wait();
+
+        {
+            std::lock_guard<std::mutex> lock (mutex);
+            job = std::forward<F>(fn);
+            busy = true;
+        }
+
+        wake.notify_all();
+    }
+
+    // Waits for the current job, and rethrows anything it threw.
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock (mutex);
+        wake.wait(lock, [&]{ return !busy; });
+
+        if (error)
+            std::rethrow_exception(std::exchange(error, nullptr));
+    }
+};
+
+#endif // WORKER_HPP